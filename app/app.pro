@@ -48,6 +48,12 @@ HEADERS += \
     include/client.hpp \
     include/config.h \
     include/indexer.hpp \
+    include/hasher.hpp \
+    include/watcher.hpp \
+    include/glob.hpp \
+    include/sequence.hpp \
+    include/hash_cache.hpp \
+    include/throttle.hpp \
     include/natpmp.hpp \
     include/port.hpp \
     include/qobjects.hpp \
@@ -74,12 +80,24 @@ SOURCES += \
     tests/thread_pool_test.cpp \
     tests/cdc512_test.cpp \
     tests/indexer_test.cpp \
+    tests/hasher_test.cpp \
+    tests/watcher_test.cpp \
+    tests/glob_test.cpp \
+    tests/sequence_test.cpp \
+    tests/hash_cache_test.cpp \
+    tests/throttle_test.cpp \
     tests/locale_traits_test.cpp \
     tests/tracker_test.cpp \
     tests/rand_test.cpp \
     tests/socket_test.cpp \
     src/cdc512.cpp \
     src/indexer.cpp \
+    src/hasher.cpp \
+    src/watcher.cpp \
+    src/glob.cpp \
+    src/sequence.cpp \
+    src/hash_cache.cpp \
+    src/throttle.cpp \
     src/main.cpp \
     src/tracker.cpp \
     src/port.cpp \
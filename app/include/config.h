@@ -65,6 +65,58 @@
 #   endif
 #endif
 //------------------------------------------------------------------------------
+#if !defined(HAVE_GETDENTS64)
+#   if __linux__
+#       define HAVE_GETDENTS64 1
+#   endif
+#endif
+//------------------------------------------------------------------------------
+#if !defined(HAVE_IO_URING)
+#   if __linux__ && !__ANDROID__ && defined(__has_include)
+#       if __has_include(<linux/io_uring.h>)
+#           define HAVE_IO_URING 1
+#       endif
+#   endif
+#endif
+//------------------------------------------------------------------------------
+#if !defined(HAVE_IOPRIO)
+#   if __linux__
+#       define HAVE_IOPRIO 1
+#   endif
+#endif
+//------------------------------------------------------------------------------
+#if !defined(HAVE_FADVISE)
+#   if __linux__
+#       define HAVE_FADVISE 1
+#   endif
+#endif
+//------------------------------------------------------------------------------
+#if !defined(HAVE_SEEK_HOLE)
+#   if __linux__ && defined(SEEK_HOLE)
+#       define HAVE_SEEK_HOLE 1
+#   endif
+#endif
+//------------------------------------------------------------------------------
+#if !defined(HAVE_INOTIFY)
+#   if __linux__
+#       define HAVE_INOTIFY 1
+#   endif
+#endif
+//------------------------------------------------------------------------------
+#if !defined(HAVE_FANOTIFY)
+#   if __linux__ && !__ANDROID__ && defined(__has_include)
+#       if __has_include(<sys/fanotify.h>)
+#           define HAVE_FANOTIFY 1
+#       endif
+#   endif
+#endif
+//------------------------------------------------------------------------------
+#if !defined(HAVE_MMAP)
+#   if !_WIN32
+#       define HAVE_MMAP 1
+#   endif
+#endif
+//------------------------------------------------------------------------------
 #if !defined(HAVE_CODECVT)
 #   if __GNUC__ >= 5 || _MSC_VER >= 1900
 #       define HAVE_CODECVT 1
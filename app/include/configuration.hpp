@@ -37,6 +37,7 @@
 #include "variant.hpp"
 #include "std_ext.hpp"
 #include "sqlite3pp/sqlite3pp.h"
+#include "sequence.hpp"
 //------------------------------------------------------------------------------
 namespace homeostas {
 //------------------------------------------------------------------------------
@@ -337,7 +338,7 @@ public:
         st_sel_by_pid_ = nullptr;
         st_ins_ = nullptr;
         st_upd_ = nullptr;
-        st_row_next_id_ = nullptr;
+        ids_ = nullptr;
         db_ = nullptr;
         return *this;
     }
@@ -396,7 +397,7 @@ private:
         };
 
         if( id == 0 )
-            id = row_next_id_();
+            id = ids_->next();
 
         //bindey(st_sel_);
         //auto i = st_sel_->begin();
@@ -451,10 +452,8 @@ private:
         });
     }
 
-    uint64_t row_id_;
-    std::function<uint64_t()> row_next_id_;
     std::unique_ptr<sqlite3pp::database> db_;
-    std::unique_ptr<sqlite3pp::query> st_row_next_id_;
+    std::unique_ptr<id_sequence> ids_;
     std::unique_ptr<sqlite3pp::query> st_sel_;
     std::unique_ptr<sqlite3pp::query> st_sel_by_pid_;
     std::unique_ptr<sqlite3pp::command> st_ins_;
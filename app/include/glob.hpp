@@ -0,0 +1,127 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+#ifndef GLOB_HPP_INCLUDED
+#define GLOB_HPP_INCLUDED
+//------------------------------------------------------------------------------
+#pragma once
+//------------------------------------------------------------------------------
+#include "config.h"
+//------------------------------------------------------------------------------
+#include <cstdint>
+#include <string>
+#include <vector>
+//------------------------------------------------------------------------------
+#include "std_ext.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+// gitignore style patterns, one per line, compiled into DFA over bytes of
+// path relative to matching root, components separated by slash:
+//
+//  # comment       blank lines and comments are ignored
+//  *.tmp           pattern without slash matches name at any level
+//  /build          leading or middle slash anchors pattern to root
+//  cache/          trailing slash matches directories only
+//  a/**/b, **/a    double asterisk component matches any number of directories
+//  a/**            everything inside a
+//  !keep.tmp       negation, the last matching pattern wins
+//
+// '*' and '?' do not match slash, '[...]' classes support ranges and '!' or
+// '^' negation, backslash escapes next character. DFA is immutable after
+// compilation and may be shared by threads, every thread keeps its own states.
+class glob_matcher {
+public:
+    typedef uint32_t state;
+
+    glob_matcher() {
+        compile(std::string());
+    }
+
+    explicit glob_matcher(const std::string & patterns) {
+        compile(patterns);
+    }
+
+    glob_matcher & compile(const std::string & patterns);
+
+    // no patterns, nothing matches
+    bool empty() const {
+        return patterns_ == 0;
+    }
+
+    state start() const {
+        return start_;
+    }
+
+    state step(state s, uint8_t c) const {
+        return next_[s * classes_ + class_[c]];
+    }
+
+    state step(state s, const std::string & name) const {
+        for( auto c : name )
+            s = step(s, uint8_t(c));
+
+        return s;
+    }
+
+    // no pattern can match path having this prefix
+    bool dead(state s) const {
+        return s == 0;
+    }
+
+    bool match(state s, bool is_dir) const {
+        return (accept_[s] & (is_dir ? DirMatch : FileMatch)) != 0;
+    }
+
+    // whole relative path, slash separated
+    bool match(const std::string & path, bool is_dir) const {
+        return match(step(start_, path), is_dir);
+    }
+protected:
+    enum {
+        FileMatch   = 1,
+        DirMatch    = 2
+    };
+
+    uint8_t class_[256];
+    size_t classes_ = 0;
+    size_t patterns_ = 0;
+    state start_ = 0;
+    std::vector<state> next_;
+    std::vector<uint8_t> accept_;
+};
+//------------------------------------------------------------------------------
+namespace tests {
+//------------------------------------------------------------------------------
+void glob_test();
+//------------------------------------------------------------------------------
+} // namespace tests
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
+#endif // GLOB_HPP_INCLUDED
+//------------------------------------------------------------------------------
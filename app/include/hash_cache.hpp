@@ -0,0 +1,91 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+#ifndef HASH_CACHE_HPP_INCLUDED
+#define HASH_CACHE_HPP_INCLUDED
+//------------------------------------------------------------------------------
+#pragma once
+//------------------------------------------------------------------------------
+#include "config.h"
+//------------------------------------------------------------------------------
+#include <memory>
+#include <string>
+#include <vector>
+//------------------------------------------------------------------------------
+#include "std_ext.hpp"
+#include "hasher.hpp"
+#include "sqlite3pp/sqlite3pp.h"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+// file digests kept apart from index database, keyed by inode and valid while
+// its size, mtime and ctime are the same, so rebuilt index reads only files
+// changed since, losing the cache file costs rehashing only
+class hash_cache {
+public:
+    struct file_identity {
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t file_size;
+        uint64_t mtime;         // nanoseconds
+        uint64_t ctime;         // nanoseconds
+    };
+
+    explicit hash_cache(const std::string & path_name);
+    ~hash_cache();
+
+    // fills digest and blocks of job if file is the same and it was hashed
+    // with the same block size and chunking
+    bool load(file_hash_job & job, const file_identity & id);
+    void store(const file_hash_job & job, const file_identity & id);
+
+    // stores are batched into transaction, this makes them durable
+    void commit();
+
+    // set once digests of all files of index are stored
+    bool seeded();
+    void seeded(bool seeded);
+protected:
+    sqlite3pp::database db_;
+    std::unique_ptr<sqlite3pp::query> st_sel_;
+    std::unique_ptr<sqlite3pp::command> st_ins_;
+    std::vector<uint8_t> buf_;
+private:
+    hash_cache(const hash_cache &) = delete;
+    void operator = (const hash_cache &) = delete;
+};
+//------------------------------------------------------------------------------
+namespace tests {
+//------------------------------------------------------------------------------
+void hash_cache_test();
+//------------------------------------------------------------------------------
+} // namespace tests
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
+#endif // HASH_CACHE_HPP_INCLUDED
+//------------------------------------------------------------------------------
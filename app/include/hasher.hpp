@@ -0,0 +1,271 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+#ifndef HASHER_HPP_INCLUDED
+#define HASHER_HPP_INCLUDED
+//------------------------------------------------------------------------------
+#pragma once
+//------------------------------------------------------------------------------
+#include "config.h"
+//------------------------------------------------------------------------------
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+//------------------------------------------------------------------------------
+#include "std_ext.hpp"
+#include "cdc512.hpp"
+#include "throttle.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+struct file_block {
+    uint64_t offset;
+    uint64_t length;
+    std::key512 digest;
+};
+//------------------------------------------------------------------------------
+struct file_hash_job {
+    std::string path_name;
+    uint64_t entry_id = 0;
+    uint64_t mtime = 0;         // nanoseconds, as seen by directory enumeration
+    uint64_t file_size = 0;     // expected size, used as read plan hint only
+    uint64_t block_size = 4096;
+
+    // content defined chunking if average is not zero, block_size ignored then,
+    // zero minimum and maximum are a quarter and eight times of average
+    uint32_t chunk_min = 0;
+    uint32_t chunk_avg = 0;
+    uint32_t chunk_max = 0;
+
+    // files of this size and above are hashed straight from memory mapping,
+    // zero - never
+    uint64_t mmap_threshold = 0;
+
+    // files of this size and above cut into fixed size blocks are hashed by
+    // tree_threads at once, their digest is root of tree of blocks digests
+    // then, see blocks_tree_digest, zero - never
+    uint64_t tree_threshold = 0;
+    size_t tree_threads = 0;    // zero - hardware concurrency
+
+    // blocks hold stored ones of file grown since, fixed size ones only, if
+    // its first and last whole blocks and a sample of others are unchanged,
+    // they are kept and only the rest of file is hashed, otherwise whole
+    // file is
+    bool append = false;
+
+    // pages of file brought to page cache by hashing are dropped after it,
+    // ones resident before are left, so working set of others survives
+    bool drop_cache = false;
+
+    // descriptor opened by pipeline while read ahead, hasher takes it
+    // instead of opening file again, -1 - none
+    int fd = -1;
+
+    std::vector<file_block> blocks;
+    std::key512 digest;         // digest of blocks digests, or root of their tree
+    int error = 0;              // errno, blocks and digest undefined if not zero
+};
+//------------------------------------------------------------------------------
+// node of tree of blocks digests, leaf is block digest itself
+std::key512 blocks_tree_node(const std::key512 & left, const std::key512 & right);
+//------------------------------------------------------------------------------
+// root of subtree over blocks [first, last), left subtree of node covers the
+// largest power of two blocks less than count, so aligned power of two ranges
+// are nodes of every tree, and range of blocks is verified against file
+// digest by roots of the rest ranges without rehashing the file
+std::key512 blocks_tree_digest(const std::vector<file_block> & blocks, size_t first, size_t last);
+//------------------------------------------------------------------------------
+// digest of block of zeros, holes of sparse files are hashed by it without
+// reading, and stored blocks of zeros are told by it from the rest
+std::key512 zero_block_digest(uint64_t length);
+//------------------------------------------------------------------------------
+class block_splitter;
+class file_holes;
+//------------------------------------------------------------------------------
+class file_hasher {
+public:
+    typedef std::function<void(file_hash_job &)> completion;
+
+    virtual ~file_hasher() {}
+
+    // completion called on the calling thread for every job in order of
+    // completion, jobs left unfinished by shutdown are not reported
+    virtual void hash(
+        std::vector<file_hash_job> & jobs,
+        const completion & done,
+        bool * p_shutdown = nullptr) = 0;
+
+    virtual const char * name() const = 0;
+
+    // io_uring based hasher if requested and supported by kernel,
+    // otherwise synchronous one, reads are charged to throttle if any
+    static std::unique_ptr<file_hasher> make(
+        bool async_io = true,
+        std::shared_ptr<io_throttle> throttle = nullptr);
+protected:
+    std::shared_ptr<io_throttle> throttle_;
+
+    // false if interrupted by shutdown while waiting for budget
+    bool throttle(uint64_t bytes, uint64_t ops, bool * p_shutdown) {
+        return throttle_ == nullptr || throttle_->acquire(bytes, ops, [&] {
+            return p_shutdown != nullptr && *p_shutdown;
+        });
+    }
+
+    friend class file_hash_pipeline;
+
+    static int open(const std::string & path_name, int & fd);
+    // takes descriptor opened by pipeline if any, opens file otherwise
+    static int open(file_hash_job & job, int & fd);
+    static void close(int fd);
+#if HAVE_MMAP
+    // returns false if interrupted by shutdown
+    bool hash_mapped(file_hash_job & job, int fd, bool * p_shutdown);
+#endif
+    static bool tree_mode(const file_hash_job & job) {
+        return job.tree_threshold != 0 && job.chunk_avg == 0 && job.file_size >= job.tree_threshold;
+    }
+
+    // returns false if interrupted by shutdown
+    bool hash_tree(file_hash_job & job, int fd, bool * p_shutdown);
+    bool hash_appended(file_hash_job & job, int fd, bool * p_shutdown);
+    bool hash_sparse(file_hash_job & job, int fd, bool * p_shutdown);
+
+    // positioned reads of [offset, end) into splitter, whole blocks in
+    // holes are not read, end of file ends infinite range, read error is
+    // left in job, returns false if interrupted by shutdown
+    bool read_range(
+        file_hash_job & job,
+        int fd,
+        block_splitter & splitter,
+        const file_holes & holes,
+        std::vector<uint8_t> & buf,
+        uint64_t offset,
+        uint64_t end,
+        bool * p_shutdown);
+};
+//------------------------------------------------------------------------------
+// hashing stage between directory enumeration and database writer, jobs are
+// hashed by thread pool workers each with own hasher, results are handed back
+// to the thread which pushes jobs, so it stays the only database writer
+class file_hash_pipeline {
+public:
+    ~file_hash_pipeline();
+
+    // zero threads - hash on calling thread in batches
+    file_hash_pipeline(
+        size_t threads = 0,
+        bool async_io = true,
+        size_t max_pending = 4096,
+        uint64_t max_pending_size = 256 * 1024 * 1024,
+        bool * p_shutdown = nullptr,
+        std::shared_ptr<io_throttle> throttle = nullptr);
+
+    // blocks while pending jobs over limits, handing back results meanwhile
+    void push(file_hash_job && job, const file_hasher::completion & done);
+    // hands back results available now
+    void drain(const file_hasher::completion & done);
+    // hands back results until all pushed jobs done
+    void finish(const file_hasher::completion & done);
+protected:
+    size_t threads_;
+    bool async_io_;
+    size_t max_pending_;
+    uint64_t max_pending_size_;
+    bool * p_shutdown_;
+    std::shared_ptr<io_throttle> throttle_;
+
+    // jobs pushed but not handed back yet
+    size_t pending_ = 0;
+    uint64_t pending_size_ = 0;
+
+    std::mutex mtx_;
+    std::condition_variable workers_cv_;
+    std::condition_variable writer_cv_;
+    std::deque<file_hash_job> queue_;
+
+    // jobs at queue front opened and advised to kernel ahead of hashing, so
+    // their first reads do not wait for device, bytes asked ahead are about
+    // a second of hashing, so device is kept busy without flooding cache
+    static constexpr const uint64_t min_ahead = 1024 * 1024;
+    static constexpr const uint64_t max_ahead = 64 * 1024 * 1024;
+    static constexpr const size_t max_ready = 64;
+
+    std::deque<file_hash_job> ready_;
+    std::deque<uint64_t> advised_;  // bytes asked ahead for ready jobs
+    uint64_t ahead_ = 0;
+    uint64_t rate_ = 0;             // hash throughput of worker, bytes per second, smoothed
+    bool advising_ = false;
+
+    std::vector<file_hash_job> results_;
+    std::vector<file_hash_job> delivered_;
+    std::vector<std::shared_future<void>> workers_;
+    std::exception_ptr error_;
+    bool abort_ = false;
+    bool finished_ = false;
+
+    // used by calling thread if there are no workers
+    std::unique_ptr<file_hasher> hasher_;
+
+    bool shutdown() const {
+        return p_shutdown_ != nullptr && *p_shutdown_;
+    }
+
+    void worker();
+    // ready jobs first, queued ones if there are none
+    void take(std::vector<file_hash_job> & batch, size_t n);
+    // reads ahead jobs following taken ones, lock is released meanwhile
+    void advise(std::unique_lock<std::mutex> & lock);
+    void hash(
+        file_hasher & hasher,
+        std::vector<file_hash_job> & batch,
+        const file_hasher::completion & done,
+        bool * p_shutdown);
+    // closes descriptors of jobs left
+    void discard();
+    void deliver(std::unique_lock<std::mutex> & lock, const file_hasher::completion & done);
+    void stop(std::unique_lock<std::mutex> & lock);
+    void flush(const file_hasher::completion & done);
+private:
+    file_hash_pipeline(const file_hash_pipeline &) = delete;
+    void operator = (const file_hash_pipeline &) = delete;
+};
+//------------------------------------------------------------------------------
+namespace tests {
+//------------------------------------------------------------------------------
+void hasher_test();
+//------------------------------------------------------------------------------
+} // namespace tests
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
+#endif // HASHER_HPP_INCLUDED
+//------------------------------------------------------------------------------
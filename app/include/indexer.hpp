@@ -35,51 +35,88 @@
 #if __linux__ && !__ANDROID__
 #   include <sys/io.h>
 #endif
+#include <atomic>
 #include <functional>
 #include <string>
+#include <map>
+#include <memory>
 #include <forward_list>
 //------------------------------------------------------------------------------
 #include "std_ext.hpp"
+#include "throttle.hpp"
 #include "sqlite3pp/sqlite3pp.h"
 //------------------------------------------------------------------------------
 namespace homeostas {
 //------------------------------------------------------------------------------
 ////////////////////////////////////////////////////////////////////////////////
 //------------------------------------------------------------------------------
+struct directory_entry {
+    std::string path;       // parent directory path
+    std::string name;
+    std::string path_name;
+    uintptr_t level = 0;
+
+    // atime is left zero by linux backend, indexer does not use it
+    uint64_t atime = 0;
+    uint64_t ctime = 0;
+    uint64_t mtime = 0;
+    uint32_t atime_ns = 0;
+    uint32_t ctime_ns = 0;
+    uint32_t mtime_ns = 0;
+    uint64_t fsize = 0;
+
+    // file identity, zero inode where platform has none
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+    uint64_t nlink = 0;
+    bool is_dir = false;
+    bool is_reg = false;
+    bool is_lnk = false;
+
+    bool skip = false;      // set by manipulator to not descend into directory
+};
+//------------------------------------------------------------------------------
 struct directory_reader {
-    std::function<void()> manipulator_;
+    // always called on the thread which calls read(), directories are
+    // delivered parent first, entries of every directory sorted by name
+    std::function<void(directory_entry &)> manipulator_;
+
+    // called on the same thread after all entries of directory are
+    // delivered, even if it is empty, not called if listing is incomplete,
+    // level is one of its entries
+    std::function<void(const std::string & path, uintptr_t level)> listed_;
 
-    std::string path_;
-    std::string path_name_;
-    std::string name_;
+    // gitignore style patterns, see glob_matcher, relative to path passed
+    // to read(), mask selects files, excluded directories are not descended
     std::string mask_;
     std::string exclude_;
-    uintptr_t level_ = 0;
     uintptr_t max_level_ = 0;
 
+    // path of directory delivered by interrupted read, directories before
+    // it in depth first order are neither listed nor delivered, it and its
+    // ancestors are listed to descend further but not delivered, empty - none
+    std::string resume_;
+
+    // zero - traverse on calling thread, otherwise number of thread pool
+    // workers listing directories ahead of manipulator
+    size_t threads_ = 0;
+    // limit of listed but not yet manipulated entries in parallel mode
+    size_t max_pending_ = 65536;
+
+    // directory reads are charged to it if set
+    std::shared_ptr<io_throttle> throttle_;
+
     bool list_dot_ = false;
     bool list_dotdot_ = false;
     bool list_directories_ = false;
     bool recursive_ = false;
 
-    uint64_t atime_ = 0;
-    uint64_t ctime_ = 0;
-    uint64_t mtime_ = 0;
-    uint32_t atime_ns_ = 0;
-    uint32_t ctime_ns_ = 0;
-    uint32_t mtime_ns_ = 0;
-    uint64_t fsize_ = 0;
-    bool is_dir_ = false;
-    bool is_reg_ = false;
-    bool is_lnk_ = false;
-
-    bool abort_ = false;
-    bool skip_ = false;
+    std::atomic<bool> abort_ = { false };
 
     template <typename Manipul>
     void read(const std::string & root_path, const Manipul & ml) {
-        this->manipulator_ = [&] {
-            ml();
+        this->manipulator_ = [&] (directory_entry & e) {
+            ml(e);
         };
 
         read(root_path);
@@ -92,6 +129,9 @@ struct directory_reader {
 //------------------------------------------------------------------------------
 class directory_indexer {
 public:
+    // directory path name -> list its subdirectories too
+    typedef std::map<std::string, bool> dirty_paths;
+
     directory_indexer() {}
 
     const auto & modified_only() const {
@@ -103,12 +143,266 @@ public:
         return *this;
     }
 
+    const auto & traversal_threads() const {
+        return traversal_threads_;
+    }
+
+    directory_indexer & traversal_threads(size_t traversal_threads) {
+        traversal_threads_ = traversal_threads;
+        return *this;
+    }
+
+    // listed but not yet indexed entries limit
+    const auto & traversal_pending() const {
+        return traversal_pending_;
+    }
+
+    directory_indexer & traversal_pending(size_t traversal_pending) {
+        traversal_pending_ = traversal_pending;
+        return *this;
+    }
+
+    // zero - hash files on the thread which calls reindex
+    const auto & hash_threads() const {
+        return hash_threads_;
+    }
+
+    directory_indexer & hash_threads(size_t hash_threads) {
+        hash_threads_ = hash_threads;
+        return *this;
+    }
+
+    // limits of files queued for hashing or hashed but not yet stored
+    const auto & hash_pending() const {
+        return hash_pending_;
+    }
+
+    directory_indexer & hash_pending(size_t hash_pending) {
+        hash_pending_ = hash_pending;
+        return *this;
+    }
+
+    const auto & hash_pending_size() const {
+        return hash_pending_size_;
+    }
+
+    directory_indexer & hash_pending_size(uint64_t hash_pending_size) {
+        hash_pending_size_ = hash_pending_size;
+        return *this;
+    }
+
+    // zero - fixed size blocks, otherwise average size of content defined
+    // chunks, zero minimum and maximum are a quarter and eight times of it
+    const auto & chunk_avg() const {
+        return chunk_avg_;
+    }
+
+    directory_indexer & chunk_avg(uint32_t chunk_avg) {
+        chunk_avg_ = chunk_avg;
+        return *this;
+    }
+
+    const auto & chunk_min() const {
+        return chunk_min_;
+    }
+
+    directory_indexer & chunk_min(uint32_t chunk_min) {
+        chunk_min_ = chunk_min;
+        return *this;
+    }
+
+    const auto & chunk_max() const {
+        return chunk_max_;
+    }
+
+    directory_indexer & chunk_max(uint32_t chunk_max) {
+        chunk_max_ = chunk_max;
+        return *this;
+    }
+
+    // limits of block size, it grows by powers of two with file size
+    // giving about thousand blocks for file, limits are powers of two
+    // from 512B to 1GiB, minimum is rounded up, maximum down but not below
+    // minimum
+    static constexpr const uint64_t lowest_block_size = 512;
+    static constexpr const uint64_t highest_block_size = 1024 * 1024 * 1024;
+
+    const auto & min_block_size() const {
+        return min_block_size_;
+    }
+
+    directory_indexer & min_block_size(uint64_t min_block_size) {
+        min_block_size_ = lowest_block_size;
+
+        while( min_block_size_ < min_block_size && min_block_size_ < highest_block_size )
+            min_block_size_ <<= 1;
+
+        if( max_block_size_ < min_block_size_ )
+            max_block_size_ = min_block_size_;
+
+        return *this;
+    }
+
+    const auto & max_block_size() const {
+        return max_block_size_;
+    }
+
+    directory_indexer & max_block_size(uint64_t max_block_size) {
+        max_block_size_ = min_block_size_;
+
+        while( max_block_size_ * 2 <= max_block_size && max_block_size_ < highest_block_size )
+            max_block_size_ <<= 1;
+
+        return *this;
+    }
+
+    uint64_t block_size(uint64_t file_size) const;
+
+    // files of this size and above are hashed from memory mapping,
+    // zero - always read
+    const auto & mmap_threshold() const {
+        return mmap_threshold_;
+    }
+
+    directory_indexer & mmap_threshold(uint64_t mmap_threshold) {
+        mmap_threshold_ = mmap_threshold;
+        return *this;
+    }
+
+    // files of this size and above with fixed size blocks are hashed by
+    // tree_threads at once, their digest is root of tree of blocks digests,
+    // zero - never, change does not rehash already indexed files
+    const auto & tree_threshold() const {
+        return tree_threshold_;
+    }
+
+    directory_indexer & tree_threshold(uint64_t tree_threshold) {
+        tree_threshold_ = tree_threshold;
+        return *this;
+    }
+
+    // zero - hardware concurrency
+    const auto & tree_threads() const {
+        return tree_threads_;
+    }
+
+    directory_indexer & tree_threads(size_t tree_threads) {
+        tree_threads_ = tree_threads;
+        return *this;
+    }
+
+    // grown file of the same inode is taken for appended to, its stored
+    // blocks are kept if a sample of them is unchanged and only the rest
+    // of file is hashed, every file is still rehashed whole once in
+    // full_rehash_interval passes, so rewrites between samples are met
+    static constexpr const uint64_t full_rehash_interval = 16;
+
+    const auto & detect_appends() const {
+        return detect_appends_;
+    }
+
+    directory_indexer & detect_appends(bool detect_appends) {
+        detect_appends_ = detect_appends;
+        return *this;
+    }
+
+    // pages read in by hashing are dropped from page cache after it, so
+    // working set of other processes is not evicted by scan
+    const auto & drop_cache() const {
+        return drop_cache_;
+    }
+
+    directory_indexer & drop_cache(bool drop_cache) {
+        drop_cache_ = drop_cache;
+        return *this;
+    }
+
+    // full pass interrupted by shutdown or error keeps its position in
+    // database, next full pass resumes from it instead of listing whole tree
+    // again, changes made meanwhile in part passed are met by pass after it
+    const auto & resumable() const {
+        return resumable_;
+    }
+
+    directory_indexer & resumable(bool resumable) {
+        resumable_ = resumable;
+        return *this;
+    }
+
+    const auto & async_io() const {
+        return async_io_;
+    }
+
+    // read files through io_uring where kernel supports it
+    directory_indexer & async_io(bool async_io) {
+        async_io_ = async_io;
+        return *this;
+    }
+
+    // side database of file digests keyed by inode, index rebuilt from
+    // scratch reads only files changed since they were cached, empty - none
+    const auto & hash_cache_path() const {
+        return hash_cache_path_;
+    }
+
+    directory_indexer & hash_cache_path(const std::string & hash_cache_path) {
+        hash_cache_path_ = hash_cache_path;
+        return *this;
+    }
+
+    // shared by directory reads and hashing, null - unlimited
+    const auto & throttle() const {
+        return throttle_;
+    }
+
+    directory_indexer & throttle(std::shared_ptr<io_throttle> throttle) {
+        throttle_ = std::move(throttle);
+        return *this;
+    }
+
     void reindex(
         sqlite3pp::database & db,
         const std::string & dir_path_name,
-        bool * p_shutdown = nullptr);
+        bool * p_shutdown = nullptr) {
+        reindex_paths(db, dir_path_name, nullptr, p_shutdown);
+    }
+
+    // reindex content of changed directories only, directories unknown to
+    // database are listed whole from their nearest indexed ancestor
+    void reindex(
+        sqlite3pp::database & db,
+        const std::string & dir_path_name,
+        const dirty_paths & paths,
+        bool * p_shutdown = nullptr) {
+        reindex_paths(db, dir_path_name, &paths, p_shutdown);
+    }
 protected:
+    void reindex_paths(
+        sqlite3pp::database & db,
+        const std::string & dir_path_name,
+        const dirty_paths * p_paths,
+        bool * p_shutdown);
+
     bool modified_only_ = true;
+    size_t traversal_threads_ = 0;
+    size_t traversal_pending_ = 65536;
+    size_t hash_threads_ = 0;
+    size_t hash_pending_ = 4096;
+    uint64_t hash_pending_size_ = 256 * 1024 * 1024;
+    uint32_t chunk_min_ = 0;
+    uint32_t chunk_avg_ = 0;
+    uint32_t chunk_max_ = 0;
+    uint64_t min_block_size_ = 4096;
+    uint64_t max_block_size_ = 1024 * 1024;
+    uint64_t mmap_threshold_ = 16 * 1024 * 1024;
+    uint64_t tree_threshold_ = 0;
+    size_t tree_threads_ = 0;
+    bool async_io_ = true;
+    bool drop_cache_ = false;
+    bool detect_appends_ = false;
+    bool resumable_ = true;
+    std::string hash_cache_path_;
+    std::shared_ptr<io_throttle> throttle_;
 private:
     directory_indexer(const directory_indexer &) = delete;
     void operator = (const directory_indexer &) = delete;
@@ -0,0 +1,81 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+#ifndef SEQUENCE_HPP_INCLUDED
+#define SEQUENCE_HPP_INCLUDED
+//------------------------------------------------------------------------------
+#pragma once
+//------------------------------------------------------------------------------
+#include "config.h"
+//------------------------------------------------------------------------------
+#include <memory>
+#include <string>
+//------------------------------------------------------------------------------
+#include "std_ext.hpp"
+#include "sqlite3pp/sqlite3pp.h"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+// hands out row ids from ranges reserved in persistent sequences table, first
+// reservation starts sequence at random point so ids of different databases
+// and trackers do not collide, ids once reserved are never handed out again
+class id_sequence {
+public:
+    id_sequence(sqlite3pp::database & db, const std::string & name, uint64_t range = 4096);
+
+    uint64_t next() {
+        if( next_id_ == last_id_ )
+            reserve();
+
+        return next_id_++;
+    }
+protected:
+    void reserve();
+
+    sqlite3pp::database & db_;
+    std::string name_;
+    uint64_t range_;
+    uint64_t next_id_ = 0;
+    uint64_t last_id_ = 0;
+    std::unique_ptr<sqlite3pp::command> st_upd_;
+    std::unique_ptr<sqlite3pp::command> st_ins_;
+    std::unique_ptr<sqlite3pp::query> st_sel_;
+private:
+    id_sequence(const id_sequence &) = delete;
+    void operator = (const id_sequence &) = delete;
+};
+//------------------------------------------------------------------------------
+namespace tests {
+//------------------------------------------------------------------------------
+void sequence_test();
+//------------------------------------------------------------------------------
+} // namespace tests
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
+#endif // SEQUENCE_HPP_INCLUDED
+//------------------------------------------------------------------------------
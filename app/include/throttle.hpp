@@ -0,0 +1,198 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+#ifndef THROTTLE_HPP_INCLUDED
+#define THROTTLE_HPP_INCLUDED
+//------------------------------------------------------------------------------
+#pragma once
+//------------------------------------------------------------------------------
+#include "config.h"
+//------------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+// token buckets of bytes and operations per second shared by all readers of
+// tracker, limits may be changed while they run. Buckets hold one second of
+// budget, larger requests go into debt which their callers wait off.
+class io_throttle {
+public:
+    io_throttle() {}
+
+    // zero - unlimited
+    uint64_t bytes_per_second() const {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return bytes_per_second_;
+    }
+
+    io_throttle & bytes_per_second(uint64_t bytes_per_second) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        bytes_per_second_ = bytes_per_second;
+        return *this;
+    }
+
+    uint64_t ops_per_second() const {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return ops_per_second_;
+    }
+
+    io_throttle & ops_per_second(uint64_t ops_per_second) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        ops_per_second_ = ops_per_second;
+        return *this;
+    }
+
+    // readers switch to idle I/O class, served only while device is not
+    // used by others, takes effect from next reindex
+    bool idle_priority() const {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return idle_priority_;
+    }
+
+    io_throttle & idle_priority(bool idle_priority) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        idle_priority_ = idle_priority;
+        return *this;
+    }
+
+    // rate is halved while latency of device stays well above its baseline
+    // and regained gradually after, without limits reads are spaced so the
+    // device is busy by them only for that share of time
+    bool latency_backoff() const {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return latency_backoff_;
+    }
+
+    io_throttle & latency_backoff(bool latency_backoff) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        latency_backoff_ = latency_backoff;
+
+        if( !latency_backoff_ )
+            scale_ = 1;
+
+        return *this;
+    }
+
+    // block device of files read, its statistics give latency of all its
+    // requests, own and of others, not blurred by page cache hits, linux
+    // only, zero - none
+    uint64_t device() const {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return device_;
+    }
+
+    io_throttle & device(uint64_t device) {
+        std::unique_lock<std::mutex> lock(mtx_);
+
+        if( device_ != device ) {
+            device_ = device;
+            ios_ = ticks_ = 0;
+        }
+
+        return *this;
+    }
+
+    // current share of limits, one if not backing off
+    double scale() const {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return scale_;
+    }
+
+    // charges budget, returns nanoseconds to wait before I/O
+    uint64_t reserve(uint64_t bytes, uint64_t ops);
+
+    // average latency of device requests over last period, fed from device
+    // statistics
+    void sample(double latency_ns) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        adjust(latency_ns);
+    }
+
+    // false if cancelled meanwhile
+    template <typename Cancelled>
+    bool acquire(uint64_t bytes, uint64_t ops, const Cancelled & cancelled) {
+        constexpr const uint64_t slice = 50000000;
+
+        for( auto wait = reserve(bytes, ops); wait != 0; ) {
+            if( cancelled() )
+                return false;
+
+            auto ns = std::min(wait, slice);
+            std::this_thread::sleep_for(std::chrono::nanoseconds(ns));
+            wait -= ns;
+        }
+
+        return true;
+    }
+protected:
+    mutable std::mutex mtx_;
+    uint64_t bytes_per_second_ = 0;
+    uint64_t ops_per_second_ = 0;
+    bool idle_priority_ = false;
+    bool latency_backoff_ = true;
+
+    // tokens, negative is debt
+    double bytes_ = 0;
+    double ops_ = 0;
+    uint64_t refilled_ = 0;
+
+    uint64_t device_ = 0;
+    uint64_t sampled_ = 0;
+    uint64_t ios_ = 0;      // requests completed by device
+    uint64_t ticks_ = 0;    // milliseconds spent by them
+
+    double scale_ = 1;
+    double latency_ = 0;    // of last period, ns
+    double baseline_ = 0;   // follows minimum, drifts slowly up to latency
+
+    void poll(uint64_t now);
+    void adjust(double latency);
+private:
+    io_throttle(const io_throttle &) = delete;
+    void operator = (const io_throttle &) = delete;
+};
+//------------------------------------------------------------------------------
+// switches calling thread to idle I/O class, returns previous one to restore
+// it with, -1 where not supported
+int enter_idle_io_priority();
+void leave_idle_io_priority(int prev);
+// idle I/O class for requests which carry own priority, zero - default
+int idle_io_priority();
+//------------------------------------------------------------------------------
+namespace tests {
+//------------------------------------------------------------------------------
+void throttle_test();
+//------------------------------------------------------------------------------
+} // namespace tests
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
+#endif // THROTTLE_HPP_INCLUDED
+//------------------------------------------------------------------------------
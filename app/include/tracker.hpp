@@ -37,6 +37,7 @@
 #include <condition_variable>
 //------------------------------------------------------------------------------
 #include "indexer.hpp"
+#include "watcher.hpp"
 #include "server.hpp"
 //------------------------------------------------------------------------------
 namespace homeostas {
@@ -156,6 +157,41 @@ public:
         return *this;
     }
 
+    // reindex changed directories on notifications, full scans are rare then
+    const auto & watch() const {
+        return watch_;
+    }
+
+    auto & watch(bool watch) {
+        watch_ = watch;
+        return *this;
+    }
+
+    // keep file digests beside database also in cache which survives its loss
+    const auto & hash_cache() const {
+        return hash_cache_;
+    }
+
+    auto & hash_cache(bool hash_cache) {
+        hash_cache_ = hash_cache;
+        return *this;
+    }
+
+    // leave page cache as it was before scans, buffered reads by default
+    const auto & drop_cache() const {
+        return drop_cache_;
+    }
+
+    auto & drop_cache(bool drop_cache) {
+        drop_cache_ = drop_cache;
+        return *this;
+    }
+
+    // limits of indexing I/O, may be adjusted while tracker runs
+    const auto & throttle() const {
+        return throttle_;
+    }
+
     void startup();
     void shutdown();
 protected:
@@ -167,6 +203,7 @@ protected:
     std::string db_name_;
     std::string db_path_;
     std::string db_path_name_;
+    std::string hash_cache_path_name_;
 
     std::unique_ptr<sqlite3pp::database> db_;
 
@@ -174,9 +211,23 @@ protected:
     std::mutex mtx_;
     std::condition_variable cv_;
 
+    // collected by watcher, guarded by mtx_
+    directory_indexer::dirty_paths dirty_;
+    bool rescan_ = false;
+
     bool started_  = false;
     bool shutdown_ = false;
     bool oneshot_  = false;
+    bool watch_    = true;
+    bool hash_cache_ = true;
+    bool drop_cache_ = false;
+
+    // idle I/O class and latency backoff, no limits by default
+    std::shared_ptr<io_throttle> throttle_ = [] {
+        auto throttle = std::make_shared<io_throttle>();
+        throttle->idle_priority(true);
+        return throttle;
+    }();
 private:
     directory_tracker(const directory_tracker &) = delete;
     void operator = (const directory_tracker &) = delete;
@@ -298,6 +349,9 @@ public:
 
     struct PACKED server_side_block_response {
         uint64_t block_no; // if zero then terminate entry
+        uint64_t block_offset; // blocks renumbered by content defined chunking
+        uint64_t block_length; // shift, so position is sent with block
+        uint8_t hole;          // block of zeros, recorded only, not acted on by receiver yet
         uint8_t deleted;
         uint8_t commit;
     };
@@ -351,9 +405,10 @@ inline auto & operator << (
     const remote_directory_tracker::server_side_block_response & e)
 {
 #if BYTE_ORDER == LITTLE_ENDIAN
-    ss << e.block_no << e.deleted << e.commit;
+    ss << e.block_no << e.block_offset << e.block_length << e.hole << e.deleted << e.commit;
 #elif BYTE_ORDER == BIG_ENDIAN
-    ss << std::htole(e.block_no) << e.deleted << e.commit;
+    ss << std::htole(e.block_no) << std::htole(e.block_offset) << std::htole(e.block_length)
+        << e.hole << e.deleted << e.commit;
 #endif
     return ss;
 }
@@ -362,9 +417,11 @@ inline auto & operator >> (
     socket_stream & ss,
     remote_directory_tracker::server_side_block_response & e)
 {
-    ss >> e.block_no >> e.deleted >> e.commit;
+    ss >> e.block_no >> e.block_offset >> e.block_length >> e.hole >> e.deleted >> e.commit;
 #if BYTE_ORDER == BIG_ENDIAN
     e.block_no = std::letoh(e.block_no);
+    e.block_offset = std::letoh(e.block_offset);
+    e.block_length = std::letoh(e.block_length);
 #endif
     return ss;
 }
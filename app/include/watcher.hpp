@@ -0,0 +1,99 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+#ifndef WATCHER_HPP_INCLUDED
+#define WATCHER_HPP_INCLUDED
+//------------------------------------------------------------------------------
+#pragma once
+//------------------------------------------------------------------------------
+#include "config.h"
+//------------------------------------------------------------------------------
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+//------------------------------------------------------------------------------
+#include "std_ext.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+class directory_watcher {
+public:
+    // called on watcher thread with directory which content changed, and
+    // recursive set if its subdirectories are new to watcher too, empty
+    // path name means events were lost and whole tree must be rescanned
+    typedef std::function<void(const std::string & path_name, bool recursive)> notifier;
+
+    virtual ~directory_watcher() {}
+
+    virtual const char * name() const = 0;
+
+    // notifications stopped on error, only full scans are reliable
+    bool failed() const {
+        return failed_;
+    }
+
+    // nullptr if change notifications are not available for directory,
+    // fanotify is used where permitted, otherwise inotify
+    static std::unique_ptr<directory_watcher> make(
+        const std::string & root_path,
+        const notifier & notify,
+        bool fanotify = true);
+protected:
+    directory_watcher(const std::string & root_path, const notifier & notify) :
+        root_path_(root_path), notify_(notify) {}
+
+    // must be called by derived destructor while its members are alive
+    void startup();
+    void shutdown();
+
+    void worker();
+    // false on unrecoverable error
+    virtual bool read_events() = 0;
+
+    std::string root_path_;
+    notifier notify_;
+    int fd_ = -1;
+
+    std::atomic<bool> shutdown_ = { false };
+    std::atomic<bool> failed_ = { false };
+    std::shared_future<void> worker_result_;
+private:
+    directory_watcher(const directory_watcher &) = delete;
+    void operator = (const directory_watcher &) = delete;
+};
+//------------------------------------------------------------------------------
+namespace tests {
+//------------------------------------------------------------------------------
+void watcher_test();
+//------------------------------------------------------------------------------
+} // namespace tests
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
+#endif // WATCHER_HPP_INCLUDED
+//------------------------------------------------------------------------------
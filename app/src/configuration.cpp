@@ -137,33 +137,7 @@ void configuration::connect_db()
                 AND name = :name
         )EOS");
 
-        st_row_next_id_ = std::make_unique<sqlite3pp::query>(*db_, R"EOS(
-            SELECT
-                id
-            FROM
-                config
-            WHERE
-                id = :id
-        )EOS");
-
-        while( (row_id_ = entropy_fast()) == 0 );
-
-        row_next_id_ = [&] {
-            at_scope_exit( st_row_next_id_->reset() );
-
-            for(;;) {
-                st_row_next_id_->bind("id", row_id_);
-                auto i = st_row_next_id_->begin();
-
-                if( i ) {
-                    while( (row_id_ = std::ihash<uint64_t>(std::rhash(row_id_) + 1) ^ row_id_) == 0 );
-                }
-                else
-                    break;
-            }
-
-            return row_id_;
-        };
+        ids_ = std::make_unique<id_sequence>(*db_, "config");
     }
 }
 //------------------------------------------------------------------------------
@@ -231,7 +205,7 @@ uint64_t configuration::get_pid(const char * var_name, const char ** p_name, boo
             pid = i->get<uint64_t>("id");
         }
         else if( create_if_not_exists ) {
-            uint64_t id = row_next_id_();
+            uint64_t id = ids_->next();
 
             st_ins_->bind("id"        , id);
             st_ins_->bind("parent_id" , pid);
@@ -0,0 +1,354 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+#include "config.h"
+//------------------------------------------------------------------------------
+#include <algorithm>
+#include <bitset>
+#include <map>
+//------------------------------------------------------------------------------
+#include "glob.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+namespace {
+//------------------------------------------------------------------------------
+typedef std::bitset<256> byte_set;
+//------------------------------------------------------------------------------
+// patterns are chains of states without epsilon transitions, star is a loop
+// on its state, so subset construction needs no closures
+struct glob_nfa {
+    struct edge {
+        size_t set;
+        uint32_t target;
+    };
+
+    struct node {
+        std::vector<edge> edges;
+        intptr_t pattern = -1;  // index of pattern accepted in this node
+    };
+
+    std::vector<byte_set> sets;
+    std::map<std::string, size_t> sets_index;
+    std::vector<node> nodes;
+
+    uint32_t add_node() {
+        nodes.emplace_back();
+        return uint32_t(nodes.size() - 1);
+    }
+
+    void add_edge(uint32_t from, const byte_set & s, uint32_t to) {
+        auto key = s.to_string();
+        auto i = sets_index.find(key);
+
+        if( i == sets_index.end() ) {
+            i = sets_index.emplace(std::move(key), sets.size()).first;
+            sets.push_back(s);
+        }
+
+        nodes[from].edges.push_back(edge { i->second, to });
+    }
+};
+//------------------------------------------------------------------------------
+struct glob_pattern {
+    bool negate = false;
+    bool dir_only = false;
+};
+//------------------------------------------------------------------------------
+// [...] at segment[j], on success j points to closing bracket
+bool parse_class(const std::string & segment, size_t & j, byte_set & s)
+{
+    size_t k = j + 1;
+    bool negate = k < segment.size() && (segment[k] == '!' || segment[k] == '^');
+
+    if( negate )
+        k++;
+
+    s.reset();
+
+    for( size_t first = k; k < segment.size(); k++ ) {
+        uint8_t c = uint8_t(segment[k]);
+
+        // leading bracket is literal
+        if( c == ']' && k != first ) {
+            if( negate )
+                s.flip();
+
+            s.reset('/');
+            j = k;
+
+            return true;
+        }
+
+        if( c == '\\' && k + 1 < segment.size() )
+            c = uint8_t(segment[++k]);
+
+        if( k + 2 < segment.size() && segment[k + 1] == '-' && segment[k + 2] != ']' ) {
+            uint8_t last = uint8_t(segment[k + 2]);
+
+            for( unsigned x = c; x <= last; x++ )
+                s.set(x);
+
+            k += 2;
+        }
+        else {
+            s.set(c);
+        }
+    }
+
+    return false;
+}
+//------------------------------------------------------------------------------
+} // namespace
+//------------------------------------------------------------------------------
+glob_matcher & glob_matcher::compile(const std::string & patterns)
+{
+    glob_nfa nfa;
+    std::vector<glob_pattern> infos;
+    std::vector<uint32_t> starts;
+
+    byte_set any, not_slash, slash;
+    any.set();
+    not_slash.set();
+    not_slash.reset('/');
+    slash.set('/');
+
+    size_t line_start = 0;
+
+    while( line_start < patterns.size() ) {
+        auto line_end = patterns.find('\n', line_start);
+
+        if( line_end == std::string::npos )
+            line_end = patterns.size();
+
+        std::string line = patterns.substr(line_start, line_end - line_start);
+        line_start = line_end + 1;
+
+        if( !line.empty() && line.back() == '\r' )
+            line.pop_back();
+
+        // trailing spaces are ignored unless escaped
+        while( !line.empty() && line.back() == ' ' && (line.size() < 2 || line[line.size() - 2] != '\\') )
+            line.pop_back();
+
+        if( line.empty() || line[0] == '#' )
+            continue;
+
+        glob_pattern info;
+
+        if( line[0] == '!' ) {
+            info.negate = true;
+            line.erase(0, 1);
+        }
+
+        while( !line.empty() && line.back() == '/' ) {
+            info.dir_only = true;
+            line.pop_back();
+        }
+
+        if( line.empty() )
+            continue;
+
+        if( line.find('/') == std::string::npos )
+            line.insert(0, "**/");
+        else if( line[0] == '/' )
+            line.erase(0, 1);
+
+        std::vector<std::string> segments;
+
+        for( size_t pos = 0;; ) {
+            auto next = line.find('/', pos);
+            segments.push_back(line.substr(pos, next == std::string::npos ? next : next - pos));
+
+            if( next == std::string::npos )
+                break;
+
+            pos = next + 1;
+        }
+
+        uint32_t cur = nfa.add_node();
+        starts.push_back(cur);
+
+        for( size_t i = 0; i < segments.size(); i++ ) {
+            const auto & segment = segments[i];
+            bool last = i + 1 == segments.size();
+
+            if( segment == "**" ) {
+                if( last ) {
+                    // everything inside, but not directory itself
+                    auto e = nfa.add_node();
+                    nfa.add_edge(cur, any, e);
+                    nfa.add_edge(e, any, e);
+                    cur = e;
+                }
+                else {
+                    // zero or more directories, each consumed with its slash
+                    auto d = nfa.add_node();
+                    nfa.add_edge(cur, not_slash, d);
+                    nfa.add_edge(d, not_slash, d);
+                    nfa.add_edge(d, slash, cur);
+                }
+
+                continue;
+            }
+
+            for( size_t j = 0; j < segment.size(); j++ ) {
+                uint8_t c = uint8_t(segment[j]);
+                byte_set s;
+
+                if( c == '*' ) {
+                    if( j == 0 || segment[j - 1] != '*' )
+                        nfa.add_edge(cur, not_slash, cur);
+
+                    continue;
+                }
+
+                if( c == '?' ) {
+                    s = not_slash;
+                }
+                else if( c != '[' || !parse_class(segment, j, s) ) {
+                    if( c == '\\' && j + 1 < segment.size() )
+                        c = uint8_t(segment[++j]);
+
+                    s.set(c);
+                }
+
+                auto t = nfa.add_node();
+                nfa.add_edge(cur, s, t);
+                cur = t;
+            }
+
+            if( !last ) {
+                auto t = nfa.add_node();
+                nfa.add_edge(cur, slash, t);
+                cur = t;
+            }
+        }
+
+        nfa.nodes[cur].pattern = intptr_t(infos.size());
+        infos.push_back(info);
+    }
+
+    patterns_ = infos.size();
+
+    // bytes which belong to the same sets are indistinguishable
+    std::map<std::vector<bool>, uint8_t> signatures;
+    std::vector<uint8_t> representatives;
+
+    for( unsigned c = 0; c < 256; c++ ) {
+        std::vector<bool> signature(nfa.sets.size());
+
+        for( size_t i = 0; i < nfa.sets.size(); i++ )
+            signature[i] = nfa.sets[i][c];
+
+        auto i = signatures.find(signature);
+
+        if( i == signatures.end() ) {
+            i = signatures.emplace(std::move(signature), uint8_t(representatives.size())).first;
+            representatives.push_back(uint8_t(c));
+        }
+
+        class_[c] = i->second;
+    }
+
+    classes_ = representatives.size();
+
+    // subset construction, empty set is dead state zero
+    constexpr const size_t max_states = 65536;
+    std::vector<std::vector<uint32_t>> dstates;
+    std::map<std::vector<uint32_t>, state> dindex;
+
+    auto intern = [&] (std::vector<uint32_t> && set) {
+        auto i = dindex.find(set);
+
+        if( i != dindex.end() )
+            return i->second;
+
+        if( dstates.size() >= max_states )
+            throw std::xruntime_error("Glob patterns are too complex", __FILE__, __LINE__);
+
+        auto s = state(dstates.size());
+        dindex.emplace(set, s);
+        dstates.emplace_back(std::move(set));
+
+        return s;
+    };
+
+    intern(std::vector<uint32_t>());
+    start_ = intern(std::move(starts));
+
+    next_.clear();
+    accept_.clear();
+
+    for( size_t i = 0; i < dstates.size(); i++ ) {
+        auto set = dstates[i]; // dstates grows below
+
+        for( size_t k = 0; k < classes_; k++ ) {
+            std::vector<uint32_t> target;
+
+            for( auto n : set )
+                for( const auto & e : nfa.nodes[n].edges )
+                    if( nfa.sets[e.set][representatives[k]] )
+                        target.push_back(e.target);
+
+            std::sort(target.begin(), target.end());
+            target.erase(std::unique(target.begin(), target.end()), target.end());
+
+            auto t = intern(std::move(target));
+            next_.push_back(t);
+        }
+
+        intptr_t file_winner = -1, dir_winner = -1;
+
+        for( auto n : set ) {
+            auto p = nfa.nodes[n].pattern;
+
+            if( p < 0 )
+                continue;
+
+            dir_winner = std::max(dir_winner, p);
+
+            if( !infos[size_t(p)].dir_only )
+                file_winner = std::max(file_winner, p);
+        }
+
+        uint8_t accept = 0;
+
+        if( file_winner >= 0 && !infos[size_t(file_winner)].negate )
+            accept |= FileMatch;
+
+        if( dir_winner >= 0 && !infos[size_t(dir_winner)].negate )
+            accept |= DirMatch;
+
+        accept_.push_back(accept);
+    }
+
+    return *this;
+}
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
@@ -0,0 +1,197 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+#include "config.h"
+//------------------------------------------------------------------------------
+#include <cstring>
+//------------------------------------------------------------------------------
+#include "port.hpp"
+#include "hash_cache.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+// block is packed as offset, length and digest, in host byte order, the file
+// is not meant to be moved between machines
+constexpr const size_t packed_block_size = 2 * sizeof(uint64_t) + std::key512::ssize();
+//------------------------------------------------------------------------------
+hash_cache::hash_cache(const std::string & path_name) :
+    db_(path_name)
+{
+    db_.execute_all(R"EOS(
+        PRAGMA busy_timeout = 3000;
+        PRAGMA journal_mode = WAL;
+        PRAGMA synchronous = NORMAL;
+
+        CREATE TABLE IF NOT EXISTS digests (
+            dev             INTEGER NOT NULL,
+            ino             INTEGER NOT NULL,
+            file_size       INTEGER NOT NULL,
+            mtime           INTEGER NOT NULL,
+            ctime           INTEGER NOT NULL,
+            block_size      INTEGER NOT NULL,
+            chunk_min       INTEGER NOT NULL,
+            chunk_avg       INTEGER NOT NULL,
+            chunk_max       INTEGER NOT NULL,
+            digest          BLOB NOT NULL,
+            blocks          BLOB,           /* NULL if file is empty */
+            PRIMARY KEY(dev, ino)
+        ) WITHOUT ROWID;
+    )EOS");
+
+    st_sel_ = std::make_unique<sqlite3pp::query>(db_, R"EOS(
+        SELECT
+            digest,
+            blocks
+        FROM
+            digests
+        WHERE
+            dev = :dev
+            AND ino = :ino
+            AND file_size = :file_size
+            AND mtime = :mtime
+            AND ctime = :ctime
+            AND block_size = :block_size
+            AND chunk_min = :chunk_min
+            AND chunk_avg = :chunk_avg
+            AND chunk_max = :chunk_max
+    )EOS");
+
+    // inode reused by other file replaces row of former one
+    st_ins_ = std::make_unique<sqlite3pp::command>(db_, R"EOS(
+        INSERT OR REPLACE INTO digests (
+            dev, ino, file_size, mtime, ctime, block_size, chunk_min, chunk_avg, chunk_max, digest, blocks
+        ) VALUES (
+            :dev, :ino, :file_size, :mtime, :ctime, :block_size, :chunk_min, :chunk_avg, :chunk_max, :digest, :blocks
+        )
+    )EOS");
+
+    db_.execute("BEGIN");
+}
+//------------------------------------------------------------------------------
+hash_cache::~hash_cache()
+{
+    db_.exceptions(false);
+    db_.execute("COMMIT");
+}
+//------------------------------------------------------------------------------
+bool hash_cache::load(file_hash_job & job, const file_identity & id)
+{
+    auto bind = [&] (auto & st) {
+        st.bind("dev", id.dev);
+        st.bind("ino", id.ino);
+        st.bind("file_size", id.file_size);
+        st.bind("mtime", id.mtime);
+        st.bind("ctime", id.ctime);
+        st.bind("block_size", job.chunk_avg != 0 ? 0 : job.block_size);
+        st.bind("chunk_min", job.chunk_min);
+        st.bind("chunk_avg", job.chunk_avg);
+        st.bind("chunk_max", job.chunk_max);
+    };
+
+    bind(*st_sel_);
+    at_scope_exit( st_sel_->reset() );
+
+    auto i = st_sel_->begin();
+
+    if( !i )
+        return false;
+
+    auto blocks = i->get<std::vector<uint8_t>>("blocks");
+
+    if( blocks.size() % packed_block_size != 0 )
+        return false;
+
+    job.digest = i->get<std::key512>("digest");
+    job.blocks.resize(blocks.size() / packed_block_size);
+
+    auto p = blocks.data();
+
+    for( auto & b : job.blocks ) {
+        std::memcpy(&b.offset, p, sizeof(b.offset));
+        p += sizeof(b.offset);
+        std::memcpy(&b.length, p, sizeof(b.length));
+        p += sizeof(b.length);
+        std::memcpy(b.digest.data(), p, b.digest.size());
+        p += b.digest.size();
+    }
+
+    job.error = 0;
+
+    return true;
+}
+//------------------------------------------------------------------------------
+void hash_cache::store(const file_hash_job & job, const file_identity & id)
+{
+    buf_.resize(job.blocks.size() * packed_block_size);
+
+    auto p = buf_.data();
+
+    for( const auto & b : job.blocks ) {
+        std::memcpy(p, &b.offset, sizeof(b.offset));
+        p += sizeof(b.offset);
+        std::memcpy(p, &b.length, sizeof(b.length));
+        p += sizeof(b.length);
+        std::memcpy(p, b.digest.data(), b.digest.size());
+        p += b.digest.size();
+    }
+
+    at_scope_exit( st_ins_->reset() );
+    st_ins_->bind("dev", id.dev);
+    st_ins_->bind("ino", id.ino);
+    st_ins_->bind("file_size", id.file_size);
+    st_ins_->bind("mtime", id.mtime);
+    st_ins_->bind("ctime", id.ctime);
+    st_ins_->bind("block_size", job.chunk_avg != 0 ? 0 : job.block_size);
+    st_ins_->bind("chunk_min", job.chunk_min);
+    st_ins_->bind("chunk_avg", job.chunk_avg);
+    st_ins_->bind("chunk_max", job.chunk_max);
+    st_ins_->bind("digest", job.digest, sqlite3pp::nocopy);
+    st_ins_->bind("blocks", buf_.data(), int(buf_.size()), sqlite3pp::nocopy);
+    st_ins_->execute();
+}
+//------------------------------------------------------------------------------
+void hash_cache::commit()
+{
+    db_.execute("COMMIT");
+    db_.execute("BEGIN");
+}
+//------------------------------------------------------------------------------
+bool hash_cache::seeded()
+{
+    sqlite3pp::query st(db_, "PRAGMA user_version");
+    auto i = st.begin();
+
+    return i && i->get<int>(0) != 0;
+}
+//------------------------------------------------------------------------------
+void hash_cache::seeded(bool seeded)
+{
+    db_.execute(seeded ? "PRAGMA user_version = 1" : "PRAGMA user_version = 0");
+}
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
@@ -0,0 +1,1960 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+#include "config.h"
+//------------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+#if HAVE_MMAP
+#   include <csetjmp>
+#   include <csignal>
+#   include <sys/mman.h>
+#endif
+#if HAVE_FADVISE
+#   include <unistd.h>
+#endif
+#if HAVE_IO_URING
+#   include <sys/syscall.h>
+#   include <linux/io_uring.h>
+#endif
+#if QT_CORE_LIB
+#   include <QString>
+#endif
+//------------------------------------------------------------------------------
+#include "port.hpp"
+#include "std_ext.hpp"
+#include "cdc512.hpp"
+#include "thread_pool.hpp"
+#include "hasher.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+// files are read by windows of 256KiB, block splitter is streaming, so
+// windows are not bound to block size
+static inline size_t read_window(const file_hash_job &)
+{
+    return 256 * 1024;
+}
+//------------------------------------------------------------------------------
+int file_hasher::open(const std::string & path_name, int & fd)
+{
+    int err;
+#if _WIN32
+    err = _wsopen_s(&fd, QString::fromStdString(path_name).toStdWString().c_str(), _O_RDONLY | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE);
+#elif __MINGW32__
+    err = _sopen_s(&fd, path_name.c_str(), _O_RDONLY | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE);
+#else
+#   if __linux__
+    // O_NOATIME permitted to the file owner only
+    fd = ::open(path_name.c_str(), O_RDONLY | O_NOATIME);
+
+    if( fd == -1 && errno == EPERM )
+#   endif
+    fd = ::open(path_name.c_str(), O_RDONLY);
+    err = fd == -1 ? errno : 0;
+#endif
+    return err;
+}
+//------------------------------------------------------------------------------
+int file_hasher::open(file_hash_job & job, int & fd)
+{
+    if( job.fd < 0 )
+        return open(job.path_name, fd);
+
+    fd = job.fd;
+    job.fd = -1;
+
+    return 0;
+}
+//------------------------------------------------------------------------------
+void file_hasher::close(int fd)
+{
+#if _MSC_VER
+    ::_close(fd);
+#else
+    ::close(fd);
+#endif
+}
+//------------------------------------------------------------------------------
+// residency of file pages in page cache taken before read of range, so
+// pages brought in by the read are dropped after it and others left
+class page_residency {
+public:
+    void clear() {
+        known_ = false;
+#if HAVE_FADVISE
+        pages_.clear();
+#endif
+    }
+
+    void probe(int fd, uint64_t offset, size_t size) {
+        known_ = false;
+#if HAVE_FADVISE
+        static const uint64_t page = uint64_t(::sysconf(_SC_PAGESIZE));
+
+        // readahead would bring pages past range, so next probe would take
+        // them for resident ones, it is given back by drop after the read
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+        first_ = offset / page * page;
+        auto length = size_t(offset + size - first_);
+
+        if( length == 0 )
+            return;
+
+        void * map = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, off_t(first_));
+
+        if( map == MAP_FAILED )
+            return;
+
+        pages_.resize((length + page - 1) / page);
+        known_ = ::mincore(map, length, pages_.data()) == 0;
+        ::munmap(map, length);
+#else
+        (void) fd;
+        (void) offset;
+        (void) size;
+#endif
+    }
+
+    void drop(int fd, uint64_t offset, size_t size) const {
+#if HAVE_FADVISE
+        static const uint64_t page = uint64_t(::sysconf(_SC_PAGESIZE));
+
+        at_scope_exit( ::posix_fadvise(fd, 0, 0, POSIX_FADV_NORMAL) );
+
+        if( !known_ ) {
+            ::posix_fadvise(fd, off_t(offset), off_t(size), POSIX_FADV_DONTNEED);
+            return;
+        }
+
+        auto last = std::min(size_t((offset + size - first_ + page - 1) / page), pages_.size());
+
+        for( size_t i = 0; i < last; ) {
+            if( (pages_[i] & 1) != 0 ) {
+                i++;
+                continue;
+            }
+
+            auto j = i;
+
+            while( j < last && (pages_[j] & 1) == 0 )
+                j++;
+
+            ::posix_fadvise(fd, off_t(first_ + i * page), off_t((j - i) * page), POSIX_FADV_DONTNEED);
+            i = j;
+        }
+#else
+        (void) fd;
+        (void) offset;
+        (void) size;
+#endif
+    }
+protected:
+    uint64_t first_ = 0;    // offset of the first page
+#if HAVE_FADVISE
+    std::vector<unsigned char> pages_;
+#endif
+    bool known_ = false;
+};
+//------------------------------------------------------------------------------
+// holes of sparse file rounded inward to whole blocks, they read as zeros,
+// so digests of their blocks are known without reading, holes found after
+// file is changed meanwhile would give digest of content file never had,
+// so hashing checks the file is not grown nor truncated
+class file_holes {
+public:
+    static bool sparse(int fd) {
+#if HAVE_SEEK_HOLE
+        struct stat st;
+        return ::fstat(fd, &st) == 0 && uint64_t(st.st_blocks) * 512 < uint64_t(st.st_size);
+#else
+        (void) fd;
+        return false;
+#endif
+    }
+
+    void load(int fd, uint64_t block_size) {
+        holes_.clear();
+#if HAVE_SEEK_HOLE
+        struct stat st;
+
+        if( ::fstat(fd, &st) != 0 || uint64_t(st.st_blocks) * 512 >= uint64_t(st.st_size) )
+            return;
+
+        auto size = uint64_t(st.st_size);
+        off_t data = 0;
+
+        for(;;) {
+            auto hole = ::lseek(fd, data, SEEK_HOLE);
+
+            if( hole == -1 || uint64_t(hole) >= size )
+                break;
+
+            // no data past hole, it runs up to end of file
+            data = ::lseek(fd, hole, SEEK_DATA);
+
+            auto first = (uint64_t(hole) + block_size - 1) / block_size * block_size;
+            auto last = data == -1 ? size : uint64_t(data) / block_size * block_size;
+
+            if( first < last )
+                holes_.push_back({ first, last });
+
+            if( data == -1 )
+                break;
+        }
+#else
+        (void) fd;
+        (void) block_size;
+#endif
+    }
+
+    bool empty() const {
+        return holes_.empty();
+    }
+
+    // bytes of hole from offset, zero if offset is not in hole
+    uint64_t hole(uint64_t offset) const {
+        auto i = next(offset);
+
+        if( i == holes_.begin() || (--i)->second <= offset )
+            return 0;
+
+        return i->second - offset;
+    }
+
+    // bytes from offset to the next hole
+    uint64_t data(uint64_t offset) const {
+        auto i = next(offset);
+        return i == holes_.end() ? ~uint64_t(0) : i->first - offset;
+    }
+protected:
+    std::vector<std::pair<uint64_t, uint64_t>> holes_;  // [first, last) offsets
+
+    std::vector<std::pair<uint64_t, uint64_t>>::const_iterator next(uint64_t offset) const {
+        return std::upper_bound(holes_.begin(), holes_.end(), offset, [] (uint64_t o, const std::pair<uint64_t, uint64_t> & h) {
+            return o < h.first;
+        });
+    }
+};
+//------------------------------------------------------------------------------
+// cuts file stream into fixed size blocks or content defined chunks and
+// hashes them, chunks are cut FastCDC way by gear rolling hash with
+// normalized chunking, so edit dirties only chunks around it
+class block_splitter {
+public:
+    block_splitter(file_hash_job & job) : job_(job) {
+        // appended file is resumed past its kept blocks
+        if( job_.append && !job_.blocks.empty() )
+            offset_ = job_.blocks.back().offset + job_.blocks.back().length;
+        else
+            job_.blocks.clear();
+
+        if( job_.chunk_avg != 0 ) {
+            avg_ = job_.chunk_avg;
+            min_ = job_.chunk_min != 0 ? job_.chunk_min : std::max(avg_ / 4, uint64_t(64));
+            max_ = job_.chunk_max != 0 ? job_.chunk_max : avg_ * 8;
+
+            unsigned bits = 0;
+
+            while( (uint64_t(2) << bits) <= avg_ )
+                bits++;
+
+            // high bits of gear hash depend on the longest byte sequence
+            auto mask = [] (unsigned n) {
+                return n == 0 ? 0 : ~uint64_t(0) << (64 - std::min(n, 63u));
+            };
+
+            mask_s_ = mask(bits + 2);
+            mask_l_ = mask(bits > 3 ? bits - 2 : 1);
+        }
+        else {
+            min_ = avg_ = max_ = job_.block_size;
+        }
+
+        ctx_.init();
+    }
+
+    void update(const uint8_t * data, size_t size) {
+        while( size != 0 ) {
+            bool boundary;
+            auto n = cut(data, size, boundary);
+
+            feed(data, n);
+            length_ += n;
+            data += n;
+            size -= n;
+
+            if( boundary )
+                flush();
+        }
+    }
+
+    // run of zeros not read, fixed size blocks from block boundary only
+    void zeros(uint64_t length) {
+        while( length != 0 ) {
+            auto n = std::min(length, max_);
+            job_.blocks.push_back({ offset_, n, zero_block_digest(n) });
+            offset_ += n;
+            length -= n;
+        }
+    }
+
+    void finish() {
+        if( length_ != 0 )
+            flush();
+
+        cdc512 ctx;
+        ctx.init();
+
+        for( const auto & b : job_.blocks )
+            ctx.update(std::begin(b.digest), std::end(b.digest));
+
+        ctx.final();
+        job_.digest = ctx;
+    }
+protected:
+    file_hash_job & job_;
+    cdc512 ctx_;
+    uint64_t offset_ = 0;
+    uint64_t length_ = 0;
+    uint64_t min_;
+    uint64_t avg_;
+    uint64_t max_;
+    uint64_t mask_s_ = 0;   // zero for fixed size blocks
+    uint64_t mask_l_ = 0;
+    uint64_t gear_ = 0;
+
+    // cdc512 pads every update tail, so block is fed by whole shuffles
+    uint8_t carry_[sizeof(std::shuffler512)];
+    size_t carry_size_ = 0;
+
+    void feed(const uint8_t * data, size_t size) {
+        if( carry_size_ != 0 ) {
+            auto n = std::min(size, sizeof(carry_) - carry_size_);
+            std::memcpy(carry_ + carry_size_, data, n);
+            carry_size_ += n;
+            data += n;
+            size -= n;
+
+            if( carry_size_ < sizeof(carry_) )
+                return;
+
+            ctx_.update(carry_, sizeof(carry_));
+            carry_size_ = 0;
+        }
+
+        auto whole = size / sizeof(carry_) * sizeof(carry_);
+
+        if( whole != 0 )
+            ctx_.update(data, whole);
+
+        std::memcpy(carry_, data + whole, size - whole);
+        carry_size_ = size - whole;
+    }
+
+    static const uint64_t * gear_table() {
+        // fixed seed, chunk boundaries must be the same on every host
+        static const auto table = [] {
+            std::vector<uint64_t> t(256);
+            uint64_t x = 0x486f6d656f737461ull;
+
+            for( auto & v : t ) {
+                uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                v = z ^ (z >> 31);
+            }
+
+            return t;
+        }();
+
+        return table.data();
+    }
+
+    // returns count of bytes belonging to current block
+    size_t cut(const uint8_t * p, size_t size, bool & boundary) {
+        boundary = false;
+
+        if( mask_s_ == 0 ) {
+            auto n = std::min(size, size_t(max_ - length_));
+            boundary = length_ + n == max_;
+            return n;
+        }
+
+        size_t i = 0;
+
+        // no cut points below minimum, rolling starts from it
+        if( length_ < min_ ) {
+            i = std::min(size, size_t(min_ - length_));
+
+            if( length_ + i < min_ )
+                return i;
+        }
+
+        const auto gear = gear_table();
+
+        while( i < size ) {
+            auto pos = length_ + i;
+
+            if( pos >= max_ ) {
+                boundary = true;
+                return i;
+            }
+
+            gear_ = (gear_ << 1) + gear[p[i++]];
+
+            if( (gear_ & (pos < avg_ ? mask_s_ : mask_l_)) == 0 ) {
+                boundary = true;
+                return i;
+            }
+        }
+
+        return i;
+    }
+
+    void flush() {
+        if( carry_size_ != 0 )
+            ctx_.update(carry_, carry_size_);
+
+        carry_size_ = 0;
+        ctx_.final();
+        job_.blocks.push_back({ offset_, length_, ctx_ });
+        offset_ += length_;
+        length_ = 0;
+        gear_ = 0;
+        ctx_.init();
+    }
+};
+//------------------------------------------------------------------------------
+#if HAVE_MMAP
+//------------------------------------------------------------------------------
+// access to mapping past end of file truncated meanwhile raises SIGBUS, in
+// guarded code it is turned into error of the job being hashed
+static thread_local sigjmp_buf * sigbus_env = nullptr;
+static struct sigaction sigbus_prev;
+//------------------------------------------------------------------------------
+static void sigbus_handler(int sig, siginfo_t * info, void * context)
+{
+    if( sigbus_env != nullptr )
+        siglongjmp(*sigbus_env, 1);
+
+    // not ours, pass to previous handler or fault again with default action
+    if( (sigbus_prev.sa_flags & SA_SIGINFO) != 0 && sigbus_prev.sa_sigaction != nullptr )
+        sigbus_prev.sa_sigaction(sig, info, context);
+    else if( sigbus_prev.sa_handler != SIG_DFL && sigbus_prev.sa_handler != SIG_IGN )
+        sigbus_prev.sa_handler(sig);
+    else
+        ::signal(SIGBUS, SIG_DFL);
+}
+//------------------------------------------------------------------------------
+bool file_hasher::hash_mapped(file_hash_job & job, int fd, bool * p_shutdown)
+{
+    static std::once_flag sigbus_once;
+
+    std::call_once(sigbus_once, [] {
+        struct sigaction sa;
+        std::memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = sigbus_handler;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        ::sigaction(SIGBUS, &sa, &sigbus_prev);
+    });
+
+    struct stat st;
+
+    if( ::fstat(fd, &st) != 0 ) {
+        job.error = errno;
+        return true;
+    }
+
+    // mapped holes would be read as pages of zeros
+    if( job.chunk_avg == 0 && file_holes::sparse(fd) )
+        return hash_sparse(job, fd, p_shutdown);
+
+    constexpr const uint64_t window = 64 * 1024 * 1024;
+
+    // objects with destructors live outside of guarded code, siglongjmp
+    // out of it would skip their destruction
+    block_splitter splitter(job);
+    page_residency residency;
+    sigjmp_buf env;
+    void * volatile map = MAP_FAILED;
+    volatile size_t map_size = 0;
+
+    if( sigsetjmp(env, 1) != 0 ) {
+        sigbus_env = nullptr;
+        ::munmap(map, map_size);
+        // truncated while hashed, so retried next time
+        job.error = EAGAIN;
+        return true;
+    }
+
+    for( uint64_t offset = 0; offset < uint64_t(st.st_size); offset += window ) {
+        if( p_shutdown != nullptr && *p_shutdown )
+            return false;
+
+        map_size = size_t(std::min(window, uint64_t(st.st_size) - offset));
+        map = ::mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, off_t(offset));
+
+        if( map == MAP_FAILED ) {
+            job.error = errno;
+            return true;
+        }
+
+        ::madvise(map, map_size, MADV_SEQUENTIAL);
+
+        residency.clear();
+
+        if( job.drop_cache )
+            residency.probe(fd, offset, map_size);
+
+        sigbus_env = &env;
+
+        // throttled mapping is charged by smaller parts, so budget is not
+        // spent in bursts
+        for( size_t done = 0; done < map_size; ) {
+            auto n = throttle_ != nullptr ? std::min(map_size - done, size_t(1024 * 1024)) : map_size;
+
+            if( !throttle(n, 1, p_shutdown) ) {
+                sigbus_env = nullptr;
+                ::munmap(map, map_size);
+                return false;
+            }
+
+            splitter.update(static_cast<const uint8_t *>(map) + done, n);
+            done += n;
+        }
+
+        sigbus_env = nullptr;
+
+        ::munmap(map, map_size);
+        map = MAP_FAILED;
+
+        if( job.drop_cache )
+            residency.drop(fd, offset, map_size);
+    }
+
+    splitter.finish();
+
+    return true;
+}
+//------------------------------------------------------------------------------
+#endif // HAVE_MMAP
+//------------------------------------------------------------------------------
+std::key512 blocks_tree_node(const std::key512 & left, const std::key512 & right)
+{
+    // inner node differs from leaf of the same bytes
+    uint8_t node[1 + 2 * sizeof(std::key512)];
+    node[0] = 1;
+    std::memcpy(node + 1, left.data(), sizeof(std::key512));
+    std::memcpy(node + 1 + sizeof(std::key512), right.data(), sizeof(std::key512));
+
+    cdc512 ctx;
+    ctx.init();
+    ctx.update(node, sizeof(node));
+    ctx.final();
+
+    return ctx;
+}
+//------------------------------------------------------------------------------
+std::key512 blocks_tree_digest(const std::vector<file_block> & blocks, size_t first, size_t last)
+{
+    if( last - first == 1 )
+        return blocks[first].digest;
+
+    if( last <= first ) {
+        cdc512 ctx;
+        ctx.init();
+        ctx.final();
+        return ctx;
+    }
+
+    size_t left = 1;
+
+    while( left * 2 < last - first )
+        left *= 2;
+
+    return blocks_tree_node(
+        blocks_tree_digest(blocks, first, first + left),
+        blocks_tree_digest(blocks, first + left, last));
+}
+//------------------------------------------------------------------------------
+std::key512 zero_block_digest(uint64_t length)
+{
+    // block sizes are few powers of two, lengths of tails are not kept
+    static std::mutex mtx;
+    static std::map<uint64_t, std::key512> digests;
+
+    bool keep = (length & (length - 1)) == 0;
+
+    if( keep ) {
+        std::unique_lock<std::mutex> lock(mtx);
+        auto i = digests.find(length);
+
+        if( i != digests.end() )
+            return i->second;
+    }
+
+    std::vector<uint8_t> zeros(size_t(length), 0);
+    std::key512 digest = cdc512(zeros.data(), zeros.data() + zeros.size());
+
+    if( keep ) {
+        std::unique_lock<std::mutex> lock(mtx);
+        digests.emplace(length, digest);
+    }
+
+    return digest;
+}
+//------------------------------------------------------------------------------
+// descriptor is shared by threads, so reads are positioned
+static intptr_t read_at(int fd, void * buf, size_t size, uint64_t offset)
+{
+#if _WIN32
+    OVERLAPPED ov;
+    std::memset(&ov, 0, sizeof(ov));
+    ov.Offset = DWORD(offset);
+    ov.OffsetHigh = DWORD(offset >> 32);
+
+    DWORD r;
+
+    if( !ReadFile(HANDLE(_get_osfhandle(fd)), buf, DWORD(size), &r, &ov) ) {
+        if( GetLastError() == ERROR_HANDLE_EOF )
+            return 0;
+
+        errno = EIO;
+        return -1;
+    }
+
+    return intptr_t(r);
+#else
+    intptr_t r;
+
+    do {
+        r = ::pread(fd, buf, size, off_t(offset));
+    } while( r == -1 && errno == EINTR );
+
+    return r;
+#endif
+}
+//------------------------------------------------------------------------------
+bool file_hasher::hash_appended(file_hash_job & job, int fd, bool * p_shutdown)
+{
+    auto & blocks = job.blocks;
+    std::vector<uint8_t> buf(std::max(read_window(job), size_t(job.block_size)));
+
+    // tail block is partial usually, appended data completes it
+    while( !blocks.empty() && blocks.back().length != job.block_size )
+        blocks.pop_back();
+
+    for( size_t i = 0; i < blocks.size(); i++ )
+        if( blocks[i].offset != i * job.block_size ) {
+            blocks.clear();
+            break;
+        }
+
+    // rewritten or truncated and regrown file most likely differs at its
+    // head or at end of old content, both are checked with a sample of
+    // blocks between them, change of other ones is met by periodic full
+    // rehash, see directory_indexer::detect_appends
+    constexpr const size_t samples = 8;
+    std::vector<size_t> checked;
+
+    for( size_t i = 0; i < samples && !blocks.empty(); i++ )
+        if( checked.empty() || checked.back() != i * (blocks.size() - 1) / (samples - 1) )
+            checked.push_back(i * (blocks.size() - 1) / (samples - 1));
+
+    for( auto i : checked ) {
+        if( blocks.empty() )
+            break;
+
+        const auto & b = blocks[i];
+
+        if( !throttle(b.length, 1, p_shutdown) )
+            return false;
+
+        page_residency residency;
+
+        if( job.drop_cache )
+            residency.probe(fd, b.offset, size_t(b.length));
+
+        auto r = read_at(fd, buf.data(), size_t(b.length), b.offset);
+
+        if( job.drop_cache )
+            residency.drop(fd, b.offset, size_t(b.length));
+
+        if( r == -1 ) {
+            job.error = errno;
+            return true;
+        }
+
+        if( uint64_t(r) != b.length || cdc512(buf.data(), buf.data() + r) != b.digest )
+            blocks.clear();
+    }
+
+    block_splitter splitter(job);
+    file_holes holes;
+    holes.load(fd, job.block_size);
+
+    uint64_t offset = blocks.empty() ? 0 : blocks.back().offset + blocks.back().length;
+
+    if( !read_range(job, fd, splitter, holes, buf, offset, ~uint64_t(0), p_shutdown) )
+        return false;
+
+    if( job.error == 0 )
+        splitter.finish();
+
+    return true;
+}
+//------------------------------------------------------------------------------
+bool file_hasher::hash_sparse(file_hash_job & job, int fd, bool * p_shutdown)
+{
+    struct stat st;
+
+    if( ::fstat(fd, &st) != 0 ) {
+        job.error = errno;
+        return true;
+    }
+
+    block_splitter splitter(job);
+    file_holes holes;
+    holes.load(fd, job.block_size);
+
+    std::vector<uint8_t> buf(read_window(job));
+
+    if( !read_range(job, fd, splitter, holes, buf, 0, uint64_t(st.st_size), p_shutdown) )
+        return false;
+
+    if( job.error != 0 )
+        return true;
+
+    // grown while hashed, retried next time
+    uint8_t probe;
+
+    if( read_at(fd, &probe, 1, uint64_t(st.st_size)) != 0 ) {
+        job.error = EAGAIN;
+        return true;
+    }
+
+    splitter.finish();
+
+    return true;
+}
+//------------------------------------------------------------------------------
+bool file_hasher::read_range(
+    file_hash_job & job,
+    int fd,
+    block_splitter & splitter,
+    const file_holes & holes,
+    std::vector<uint8_t> & buf,
+    uint64_t offset,
+    uint64_t end,
+    bool * p_shutdown)
+{
+    while( offset < end ) {
+        if( p_shutdown != nullptr && *p_shutdown )
+            return false;
+
+        auto hole = std::min(holes.hole(offset), end - offset);
+
+        if( hole != 0 ) {
+            splitter.zeros(hole);
+            offset += hole;
+            continue;
+        }
+
+        auto window = size_t(std::min({ uint64_t(buf.size()), end - offset, holes.data(offset) }));
+
+        if( !throttle(0, 1, p_shutdown) )
+            return false;
+
+        page_residency residency;
+
+        if( job.drop_cache )
+            residency.probe(fd, offset, window);
+
+        auto r = read_at(fd, buf.data(), window, offset);
+
+        if( r == -1 ) {
+            job.error = errno;
+            return true;
+        }
+
+        if( r == 0 ) {
+            // truncated while hashed, so retried next time
+            if( end != ~uint64_t(0) )
+                job.error = EAGAIN;
+
+            return true;
+        }
+
+        // bytes are charged as read, tail of file is shorter than window
+        if( !throttle(uint64_t(r), 0, p_shutdown) )
+            return false;
+
+        splitter.update(buf.data(), size_t(r));
+
+        if( job.drop_cache )
+            residency.drop(fd, offset, size_t(r));
+
+        offset += uint64_t(r);
+    }
+
+    return true;
+}
+//------------------------------------------------------------------------------
+bool file_hasher::hash_tree(file_hash_job & job, int fd, bool * p_shutdown)
+{
+    // file is cut into spans of whole blocks claimed by threads in turn,
+    // enough of them to even out threads slowed by others
+    const uint64_t size = job.file_size;
+    const uint64_t count = (size + job.block_size - 1) / job.block_size;
+
+    size_t threads = job.tree_threads != 0 ? job.tree_threads : std::thread::hardware_concurrency();
+    threads = std::max(threads, size_t(1));
+
+    const uint64_t span = job.block_size * std::max(uint64_t(1),
+        std::min(uint64_t(16 * 1024 * 1024) / job.block_size, count / (threads * 4)));
+    const uint64_t spans = (size + span - 1) / span;
+
+    threads = size_t(std::max(std::min(uint64_t(threads), spans), uint64_t(1)));
+
+    std::vector<file_block> blocks(static_cast<size_t>(count));
+    file_holes holes;
+    holes.load(fd, job.block_size);
+
+    std::atomic<uint64_t> next_span(0);
+    std::atomic<int> error(0);
+    std::atomic<bool> stop(false);
+
+    auto hash_spans = [&] {
+        int io_priority = throttle_ != nullptr && throttle_->idle_priority() ? enter_idle_io_priority() : -1;
+        at_scope_exit( leave_idle_io_priority(io_priority) );
+
+        std::vector<uint8_t> buf(read_window(job));
+
+        for(;;) {
+            auto n = next_span++;
+
+            if( n >= spans || stop )
+                break;
+
+            file_hash_job part;
+            part.block_size = job.block_size;
+            part.drop_cache = job.drop_cache;
+
+            block_splitter splitter(part);
+
+            if( !read_range(part, fd, splitter, holes, buf, n * span, std::min(n * span + span, size), p_shutdown) ) {
+                stop = true;
+                return;
+            }
+
+            if( part.error != 0 ) {
+                int none = 0;
+                error.compare_exchange_strong(none, part.error);
+                stop = true;
+                return;
+            }
+
+            splitter.finish();
+
+            auto first = size_t(n * span / job.block_size);
+
+            for( size_t i = 0; i < part.blocks.size(); i++ ) {
+                blocks[first + i] = part.blocks[i];
+                blocks[first + i].offset += n * span;
+            }
+        }
+    };
+
+    std::vector<std::shared_future<void>> helpers;
+
+    for( size_t i = 1; i < threads; i++ )
+        helpers.emplace_back(thread_pool_t::instance()->enqueue(hash_spans));
+
+    std::exception_ptr e;
+
+    try {
+        hash_spans();
+    }
+    catch( ... ) {
+        e = std::current_exception();
+        stop = true;
+    }
+
+    for( auto & h : helpers ) {
+        try {
+            h.get();
+        }
+        catch( ... ) {
+            e = std::current_exception();
+        }
+    }
+
+    if( e )
+        std::rethrow_exception(e);
+
+    if( error != 0 ) {
+        job.error = error;
+        return true;
+    }
+
+    if( stop )
+        return false;
+
+    // grown while hashed, retried next time too
+    uint8_t probe;
+
+    if( read_at(fd, &probe, 1, size) != 0 ) {
+        job.error = EAGAIN;
+        return true;
+    }
+
+    job.blocks = std::move(blocks);
+    job.digest = blocks_tree_digest(job.blocks, 0, job.blocks.size());
+
+    return true;
+}
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+class sync_file_hasher : public file_hasher {
+public:
+    const char * name() const override {
+        return "sync";
+    }
+
+    void hash(
+        std::vector<file_hash_job> & jobs,
+        const completion & done,
+        bool * p_shutdown) override
+    {
+        for( auto & job : jobs ) {
+            if( p_shutdown != nullptr && *p_shutdown )
+                break;
+
+            if( hash(job, p_shutdown) )
+                done(job);
+        }
+    }
+protected:
+    std::vector<uint8_t> buf_;
+
+    bool hash(file_hash_job & job, bool * p_shutdown) {
+        if( !job.append )
+            job.blocks.clear();
+
+        job.error = 0;
+
+        int fd = -1;
+
+        // open of descriptor taken from pipeline is charged there
+        if( job.fd < 0 && !throttle(0, 1, p_shutdown) )
+            return false;
+
+        if( (job.error = open(job, fd)) != 0 )
+            return true;
+
+        at_scope_exit( close(fd) );
+
+        if( tree_mode(job) )
+            return hash_tree(job, fd, p_shutdown);
+
+        if( job.append )
+            return hash_appended(job, fd, p_shutdown);
+
+        // content defined chunks do not start at holes, so they are read
+        if( job.chunk_avg == 0 && file_holes::sparse(fd) )
+            return hash_sparse(job, fd, p_shutdown);
+#if HAVE_MMAP
+        if( job.mmap_threshold != 0 && job.file_size >= job.mmap_threshold )
+            return hash_mapped(job, fd, p_shutdown);
+#endif
+        auto window = read_window(job);
+
+        if( buf_.size() < window )
+            buf_.resize(window);
+
+        block_splitter splitter(job);
+        page_residency residency;
+        uint64_t offset = 0;
+
+        for(;;) {
+            if( p_shutdown != nullptr && *p_shutdown )
+                return false;
+
+            if( !throttle(0, 1, p_shutdown) )
+                return false;
+
+            if( job.drop_cache )
+                residency.probe(fd, offset, window);
+
+            auto r =
+#if _MSC_VER
+            _read(fd, buf_.data(), uint32_t(window));
+#else
+            ::read(fd, buf_.data(), window);
+#endif
+            if( r == -1 ) {
+                if( errno == EINTR )
+                    continue;
+
+                job.error = errno;
+                return true;
+            }
+
+            if( r == 0 )
+                break;
+
+            // bytes are charged as read, tail of file is shorter than window
+            if( !throttle(uint64_t(r), 0, p_shutdown) )
+                return false;
+
+            splitter.update(buf_.data(), size_t(r));
+
+            if( job.drop_cache )
+                residency.drop(fd, offset, size_t(r));
+
+            offset += uint64_t(r);
+        }
+
+        splitter.finish();
+
+        return true;
+    }
+};
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+#if HAVE_IO_URING
+//------------------------------------------------------------------------------
+// keeps dozens of openat, statx and read requests in flight, hashing is done
+// on the calling thread as reads complete, liburing is not required
+class uring_file_hasher : public file_hasher {
+public:
+    ~uring_file_hasher() {
+        teardown();
+    }
+
+    const char * name() const override {
+        return "io_uring";
+    }
+
+    bool setup();
+
+    void hash(
+        std::vector<file_hash_job> & jobs,
+        const completion & done,
+        bool * p_shutdown) override;
+protected:
+    enum {
+        ring_entries = 128,
+        max_files = 16,     // opened at once, two requests (openat, statx) each
+        max_reads = 32      // windows in flight
+    };
+
+    struct file_state;
+
+    struct request {
+        enum { Open, Stat, Read } kind;
+        file_state * file = nullptr;
+        uint8_t * buf = nullptr;
+        uint64_t offset = 0;    // window offset in file
+        uint32_t size = 0;      // window size
+        uint32_t done = 0;      // bytes of window read so far
+        page_residency residency;
+    };
+
+    struct file_state {
+        file_hash_job * job = nullptr;
+        int fd = -1;
+        bool noatime = true;
+        bool opening = true;
+        bool stating = true;
+        uint64_t size = 0;          // read plan, reads past it probe for EOF one at a time
+        uint64_t next_offset = 0;
+        uint64_t eof = ~uint64_t(0);
+        size_t reads = 0;           // in flight or waiting in ready
+        uint64_t hashed = 0;        // offset of next window for splitter
+        bool sparse = false;        // hashed inline skipping holes instead of reads
+        std::vector<request *> ready;
+        std::unique_ptr<block_splitter> splitter;
+        request open_rq;
+        request stat_rq;
+        struct statx stx;
+    };
+
+    int ring_fd_ = -1;
+    void * ring_ = MAP_FAILED;
+    size_t ring_size_ = 0;
+    io_uring_sqe * sqes_ = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t sqes_size_ = 0;
+
+    unsigned * sq_head_ = nullptr;
+    unsigned * sq_tail_ = nullptr;
+    unsigned * sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sq_local_tail_ = 0;
+    unsigned inflight_ = 0;
+    uint16_t ioprio_ = 0;
+
+    std::vector<uint8_t> pool_;
+
+    unsigned * cq_head_ = nullptr;
+    unsigned * cq_tail_ = nullptr;
+    io_uring_cqe * cqes_ = nullptr;
+    unsigned cq_mask_ = 0;
+
+    void teardown();
+    io_uring_sqe * get_sqe();
+    void submit(unsigned wait_nr);
+    void drain();
+
+    void prep_open(file_state & f);
+    void prep_stat(file_state & f);
+    void prep_read(request & rq);
+};
+//------------------------------------------------------------------------------
+bool uring_file_hasher::setup()
+{
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+
+    ring_fd_ = int(::syscall(__NR_io_uring_setup, unsigned(ring_entries), &p));
+
+    // ENOSYS on old kernels, EPERM when disabled by sysctl or seccomp
+    if( ring_fd_ < 0 ) {
+        ring_fd_ = -1;
+        return false;
+    }
+
+    if( (p.features & IORING_FEAT_SINGLE_MMAP) == 0 )
+        return false;
+
+    ring_size_ = std::max(
+        p.sq_off.array + p.sq_entries * sizeof(unsigned),
+        p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+
+    ring_ = ::mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+
+    if( ring_ == MAP_FAILED )
+        return false;
+
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+
+    if( sqes_ == MAP_FAILED )
+        return false;
+
+    auto base = static_cast<uint8_t *>(ring_);
+
+    sq_head_ = reinterpret_cast<unsigned *>(base + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(base + p.sq_off.tail);
+    sq_array_ = reinterpret_cast<unsigned *>(base + p.sq_off.array);
+    sq_mask_ = *reinterpret_cast<unsigned *>(base + p.sq_off.ring_mask);
+    sq_entries_ = p.sq_entries;
+    sq_local_tail_ = *sq_tail_;
+
+    cq_head_ = reinterpret_cast<unsigned *>(base + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(base + p.cq_off.tail);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(base + p.cq_off.cqes);
+    cq_mask_ = *reinterpret_cast<unsigned *>(base + p.cq_off.ring_mask);
+
+    // openat, statx and read are available since 5.6, as well as probing
+    std::vector<uint8_t> pb(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    auto probe = reinterpret_cast<io_uring_probe *>(pb.data());
+
+    if( ::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE, probe, 256) < 0 )
+        return false;
+
+    for( auto op : { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ } )
+        if( op > probe->last_op || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0 )
+            return false;
+
+    return true;
+}
+//------------------------------------------------------------------------------
+void uring_file_hasher::teardown()
+{
+    if( sqes_ != MAP_FAILED )
+        ::munmap(sqes_, sqes_size_);
+
+    if( ring_ != MAP_FAILED )
+        ::munmap(ring_, ring_size_);
+
+    if( ring_fd_ != -1 )
+        ::close(ring_fd_);
+
+    sqes_ = static_cast<io_uring_sqe *>(MAP_FAILED);
+    ring_ = MAP_FAILED;
+    ring_fd_ = -1;
+}
+//------------------------------------------------------------------------------
+io_uring_sqe * uring_file_hasher::get_sqe()
+{
+    while( sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_ )
+        submit(0);
+
+    auto index = sq_local_tail_ & sq_mask_;
+    auto sqe = &sqes_[index];
+
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    sq_local_tail_++;
+    inflight_++;
+
+    return sqe;
+}
+//------------------------------------------------------------------------------
+void uring_file_hasher::submit(unsigned wait_nr)
+{
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+    for(;;) {
+        auto to_submit = sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+
+        auto r = ::syscall(__NR_io_uring_enter, ring_fd_, to_submit, wait_nr,
+            wait_nr != 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+
+        if( r >= 0 )
+            break;
+
+        auto err = errno;
+
+        if( err == EINTR )
+            continue;
+
+        // completion queue is full, caller reaps it and comes back
+        if( err == EAGAIN || err == EBUSY )
+            break;
+
+        throw std::xruntime_error("io_uring_enter failed, " + std::to_string(err), __FILE__, __LINE__);
+    }
+}
+//------------------------------------------------------------------------------
+void uring_file_hasher::drain()
+{
+    while( inflight_ != 0 ) {
+        submit(1);
+
+        auto head = *cq_head_;
+        auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+        inflight_ -= tail - head;
+        __atomic_store_n(cq_head_, tail, __ATOMIC_RELEASE);
+    }
+}
+//------------------------------------------------------------------------------
+void uring_file_hasher::prep_open(file_state & f)
+{
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uintptr_t>(f.job->path_name.c_str());
+    sqe->open_flags = O_RDONLY | O_CLOEXEC | (f.noatime ? O_NOATIME : 0);
+    sqe->user_data = reinterpret_cast<uintptr_t>(&f.open_rq);
+    f.opening = true;
+}
+//------------------------------------------------------------------------------
+void uring_file_hasher::prep_stat(file_state & f)
+{
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uintptr_t>(f.job->path_name.c_str());
+    sqe->len = STATX_SIZE | STATX_BLOCKS;
+    sqe->off = reinterpret_cast<uintptr_t>(&f.stx);
+    sqe->user_data = reinterpret_cast<uintptr_t>(&f.stat_rq);
+    f.stating = true;
+}
+//------------------------------------------------------------------------------
+void uring_file_hasher::prep_read(request & rq)
+{
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = rq.file->fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(rq.buf + rq.done);
+    sqe->len = rq.size - rq.done;
+    sqe->off = rq.offset + rq.done;
+    // openat and statx refuse priority, reads carry it
+    sqe->ioprio = ioprio_;
+    sqe->user_data = reinterpret_cast<uintptr_t>(&rq);
+}
+//------------------------------------------------------------------------------
+void uring_file_hasher::hash(
+    std::vector<file_hash_job> & jobs,
+    const completion & done,
+    bool * p_shutdown)
+{
+    size_t slot_size = 0;
+
+    ioprio_ = throttle_ != nullptr && throttle_->idle_priority() ? uint16_t(idle_io_priority()) : 0;
+
+    for( const auto & job : jobs )
+        slot_size = std::max(slot_size, read_window(job));
+
+    // buffers kept between calls, hasher is fed by small batches too
+    if( pool_.size() < slot_size * max_reads )
+        pool_.resize(slot_size * max_reads);
+
+    std::vector<request> reads(max_reads);
+    std::vector<request *> free_reads;
+
+    for( size_t i = 0; i < reads.size(); i++ ) {
+        reads[i].kind = request::Read;
+        reads[i].buf = pool_.data() + i * slot_size;
+        free_reads.push_back(&reads[i]);
+    }
+
+    std::vector<std::unique_ptr<file_state>> files;
+    size_t next_job = 0;
+    bool stop = false;
+
+    // in flight requests refer to the jobs and the buffers, so if completion
+    // throws they must be completed before leaving
+    at_scope_exit(
+        try {
+            drain();
+        }
+        catch( ... ) {
+            teardown();
+        }
+
+        for( auto & f : files )
+            if( f->fd >= 0 )
+                close(f->fd);
+    );
+
+    for(;;) {
+        stop = stop || (p_shutdown != nullptr && *p_shutdown);
+
+        // files hashed inline are handed back at loop start
+        bool hashed_inline = false;
+
+        for( auto i = files.begin(); i != files.end(); ) {
+            auto & f = **i;
+
+            if( f.opening || f.stating || f.reads != 0 ) {
+                ++i;
+                continue;
+            }
+
+            bool finished = f.fd < 0 || f.job->error != 0 || f.eof != ~uint64_t(0);
+
+            if( !finished && !stop ) {
+                ++i;
+                continue;
+            }
+
+            if( f.fd >= 0 )
+                close(f.fd);
+
+            f.fd = -1;
+
+            if( finished ) {
+                if( f.job->error == 0 && !f.sparse )
+                    f.splitter->finish();
+
+                done(*f.job);
+            }
+
+            i = files.erase(i);
+        }
+
+        if( !stop ) {
+            while( files.size() < max_files && next_job < jobs.size() ) {
+                auto & job = jobs[next_job];
+
+                // open of descriptor taken from pipeline is charged there
+                if( job.fd < 0 && !throttle(0, 1, p_shutdown) ) {
+                    stop = true;
+                    break;
+                }
+
+                next_job++;
+
+                job.error = 0;
+
+                // large files are hashed from mapping or by other threads,
+                // appended ones from their tail, meanwhile requests of
+                // others are served by kernel
+                if( tree_mode(job) || job.append || (job.mmap_threshold != 0 && job.file_size >= job.mmap_threshold) ) {
+                    int fd = -1;
+
+                    if( (job.error = open(job, fd)) == 0 ) {
+                        at_scope_exit( close(fd) );
+
+                        bool finished = tree_mode(job) ? hash_tree(job, fd, p_shutdown)
+                            : job.append ? hash_appended(job, fd, p_shutdown)
+                            : hash_mapped(job, fd, p_shutdown);
+
+                        if( !finished )
+                            continue;
+                    }
+
+                    done(job);
+                    continue;
+                }
+
+                files.emplace_back(new file_state);
+                auto & f = *files.back();
+
+                f.job = &job;
+                f.splitter.reset(new block_splitter(job));
+                f.size = job.file_size;
+                f.open_rq.kind = request::Open;
+                f.open_rq.file = &f;
+                f.stat_rq.kind = request::Stat;
+                f.stat_rq.file = &f;
+
+                if( job.fd >= 0 ) {
+                    open(job, f.fd);
+                    f.opening = false;
+                }
+                else
+                    prep_open(f);
+
+                prep_stat(f);
+            }
+
+            for( auto & pf : files ) {
+                auto & f = *pf;
+
+                if( f.opening || f.stating || f.fd < 0 || f.job->error != 0 || f.eof != ~uint64_t(0) )
+                    continue;
+
+                // whole file is hashed before its first read
+                if( f.sparse && !stop ) {
+                    if( !hash_sparse(*f.job, f.fd, p_shutdown) )
+                        stop = true;
+                    else
+                        f.eof = f.size;
+
+                    hashed_inline = true;
+                    continue;
+                }
+
+                auto window = read_window(*f.job);
+
+                while( !stop && !free_reads.empty() && (f.next_offset < f.size || f.reads == 0) ) {
+                    // read past planned size is probing for EOF
+                    auto bytes = f.next_offset < f.size ? std::min(uint64_t(window), f.size - f.next_offset) : 0;
+
+                    if( !throttle(bytes, 1, p_shutdown) ) {
+                        stop = true;
+                        break;
+                    }
+
+                    auto & rq = *free_reads.back();
+                    free_reads.pop_back();
+
+                    rq.file = &f;
+                    rq.offset = f.next_offset;
+                    rq.size = uint32_t(window);
+                    rq.done = 0;
+
+                    if( f.job->drop_cache )
+                        rq.residency.probe(f.fd, rq.offset, rq.size);
+
+                    prep_read(rq);
+
+                    f.next_offset += window;
+                    f.reads++;
+                }
+            }
+        }
+
+        if( files.empty() && (stop || next_job >= jobs.size()) )
+            break;
+
+        // stopped while waiting for throttle, files are closed at loop start
+        if( inflight_ == 0 && (stop || hashed_inline) )
+            continue;
+
+        if( inflight_ == 0 )
+            throw std::xruntime_error("io_uring hasher stalled", __FILE__, __LINE__);
+
+        submit(1);
+
+        auto head = *cq_head_;
+        auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+        for( ; head != tail; head++ ) {
+            const auto & cqe = cqes_[head & cq_mask_];
+            auto & rq = *reinterpret_cast<request *>(uintptr_t(cqe.user_data));
+            auto & f = *rq.file;
+            auto res = cqe.res;
+
+            inflight_--;
+
+            if( rq.kind == request::Open ) {
+                f.opening = false;
+
+                if( res >= 0 )
+                    f.fd = res;
+                else if( res == -EPERM && f.noatime ) {
+                    f.noatime = false;
+                    prep_open(f);
+                }
+                else
+                    f.job->error = -res;
+            }
+            else if( rq.kind == request::Stat ) {
+                f.stating = false;
+
+                if( res == 0 ) {
+                    f.size = f.stx.stx_size;
+                    f.sparse = f.job->chunk_avg == 0
+                        && (f.stx.stx_mask & STATX_BLOCKS) != 0
+                        && f.stx.stx_blocks * 512 < f.stx.stx_size;
+                }
+            }
+            else {
+                if( res == -EINTR || res == -EAGAIN ) {
+                    prep_read(rq);
+                    continue;
+                }
+
+                if( res < 0 ) {
+                    f.job->error = -res;
+                }
+                else if( res != 0 && rq.done + uint32_t(res) < rq.size ) {
+                    // short read, ask for the rest, zero read marks EOF
+                    rq.done += uint32_t(res);
+                    prep_read(rq);
+                    continue;
+                }
+                else {
+                    rq.done += uint32_t(res);
+
+                    if( rq.done < rq.size )
+                        f.eof = std::min(f.eof, rq.offset + rq.done);
+                }
+
+                // blocks are cut sequentially, windows completed ahead
+                // wait for preceding ones
+                f.ready.push_back(&rq);
+
+                for(;;) {
+                    auto r = std::find_if(f.ready.begin(), f.ready.end(), [&] (const request * a) {
+                        return a->offset == f.hashed;
+                    });
+
+                    if( r == f.ready.end() )
+                        break;
+
+                    auto & w = **r;
+
+                    if( f.job->error == 0 && w.done != 0 )
+                        f.splitter->update(w.buf, w.done);
+
+                    if( f.job->drop_cache && w.done != 0 )
+                        w.residency.drop(f.fd, w.offset, w.done);
+
+                    f.hashed += w.size;
+                    f.reads--;
+                    free_reads.push_back(&w);
+                    f.ready.erase(r);
+                }
+            }
+        }
+
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+}
+//------------------------------------------------------------------------------
+#endif // HAVE_IO_URING
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+std::unique_ptr<file_hasher> file_hasher::make(bool async_io, std::shared_ptr<io_throttle> throttle)
+{
+    std::unique_ptr<file_hasher> hasher;
+#if HAVE_IO_URING
+    if( async_io ) {
+        std::unique_ptr<uring_file_hasher> uring(new uring_file_hasher);
+
+        if( uring->setup() )
+            hasher = std::move(uring);
+    }
+#else
+    (void) async_io;
+#endif
+
+    if( hasher == nullptr )
+        hasher.reset(new sync_file_hasher);
+
+    hasher->throttle_ = std::move(throttle);
+
+    return hasher;
+}
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+file_hash_pipeline::~file_hash_pipeline()
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+
+    // not finished normally, so drop the rest
+    if( !queue_.empty() || pending_ != 0 )
+        abort_ = true;
+
+    finished_ = true;
+    lock.unlock();
+    workers_cv_.notify_all();
+
+    for( auto & w : workers_ )
+        w.wait();
+
+    discard();
+}
+//------------------------------------------------------------------------------
+file_hash_pipeline::file_hash_pipeline(
+    size_t threads,
+    bool async_io,
+    size_t max_pending,
+    uint64_t max_pending_size,
+    bool * p_shutdown,
+    std::shared_ptr<io_throttle> throttle) :
+    threads_(threads),
+    async_io_(async_io),
+    max_pending_(max_pending),
+    max_pending_size_(max_pending_size),
+    p_shutdown_(p_shutdown),
+    throttle_(std::move(throttle))
+{
+    if( threads_ == 0 ) {
+        hasher_ = file_hasher::make(async_io_, throttle_);
+        return;
+    }
+
+    for( size_t i = 0; i < threads_; i++ )
+        workers_.emplace_back(thread_pool_t::instance()->enqueue([&] { worker(); }));
+}
+//------------------------------------------------------------------------------
+void file_hash_pipeline::worker()
+{
+    std::unique_ptr<file_hasher> hasher;
+    std::vector<file_hash_job> batch;
+
+    // pool thread serves others after, so its class is restored
+    int io_priority = throttle_ != nullptr && throttle_->idle_priority() ? enter_idle_io_priority() : -1;
+    at_scope_exit( leave_idle_io_priority(io_priority) );
+
+    try {
+        hasher = file_hasher::make(async_io_, throttle_);
+
+        for(;;) {
+            std::unique_lock<std::mutex> lock(mtx_);
+
+            workers_cv_.wait(lock, [&] {
+                return abort_ || finished_ || !queue_.empty() || !ready_.empty();
+            });
+
+            if( abort_ || (queue_.empty() && ready_.empty()) )
+                break;
+
+            // take a share of the queue, enough for hasher to keep requests in flight
+            take(batch, std::max((queue_.size() + ready_.size()) / threads_, size_t(1)));
+            advise(lock);
+            lock.unlock();
+
+            hash(*hasher, batch, [&] (file_hash_job & job) {
+                std::unique_lock<std::mutex> lock(mtx_);
+                results_.emplace_back(std::move(job));
+                lock.unlock();
+                writer_cv_.notify_one();
+            }, &abort_);
+        }
+    }
+    catch( ... ) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        error_ = std::current_exception();
+        abort_ = true;
+        lock.unlock();
+        workers_cv_.notify_all();
+        writer_cv_.notify_one();
+    }
+}
+//------------------------------------------------------------------------------
+void file_hash_pipeline::deliver(std::unique_lock<std::mutex> & lock, const file_hasher::completion & done)
+{
+    if( error_ )
+        std::rethrow_exception(error_);
+
+    if( results_.empty() )
+        return;
+
+    delivered_.swap(results_);
+
+    for( const auto & job : delivered_ ) {
+        pending_--;
+        pending_size_ -= job.file_size;
+    }
+
+    lock.unlock();
+    at_scope_exit(
+        lock.lock();
+        delivered_.clear();
+    );
+
+    for( auto & job : delivered_ )
+        done(job);
+}
+//------------------------------------------------------------------------------
+void file_hash_pipeline::stop(std::unique_lock<std::mutex> & lock)
+{
+    abort_ = true;
+    lock.unlock();
+    workers_cv_.notify_all();
+    lock.lock();
+}
+//------------------------------------------------------------------------------
+void file_hash_pipeline::take(std::vector<file_hash_job> & batch, size_t n)
+{
+    n = std::min(n, size_t(64));
+
+    // jobs read ahead are hashed first, so others are read ahead meanwhile
+    if( !ready_.empty() ) {
+        while( n-- != 0 && !ready_.empty() ) {
+            ahead_ -= advised_.front();
+            batch.emplace_back(std::move(ready_.front()));
+            ready_.pop_front();
+            advised_.pop_front();
+        }
+
+        return;
+    }
+
+    while( n-- != 0 && !queue_.empty() ) {
+        batch.emplace_back(std::move(queue_.front()));
+        queue_.pop_front();
+    }
+}
+//------------------------------------------------------------------------------
+void file_hash_pipeline::advise(std::unique_lock<std::mutex> & lock)
+{
+#if HAVE_FADVISE
+    // one thread opens files ahead at a time, so they stay in queue order
+    if( advising_ )
+        return;
+
+    advising_ = true;
+
+    auto budget = std::min(std::max(rate_ * std::max(threads_, size_t(1)), min_ahead), max_ahead);
+
+    while( !abort_ && !shutdown() && !queue_.empty() && ahead_ < budget && ready_.size() < max_ready ) {
+        auto job = std::move(queue_.front());
+        queue_.pop_front();
+
+        auto n = std::min(job.file_size, budget - ahead_);
+
+        // pages read ahead would be taken for resident ones
+        if( job.drop_cache )
+            n = 0;
+
+        ahead_ += n;
+        lock.unlock();
+
+        // open is charged here, hasher takes descriptor without charging it again
+        bool charged = n != 0 && (throttle_ == nullptr || throttle_->acquire(0, 1, [&] {
+            return abort_ || shutdown();
+        }));
+
+        // failed one is opened again by hasher, which reports error
+        if( charged && file_hasher::open(job.path_name, job.fd) == 0 )
+            ::posix_fadvise(job.fd, 0, off_t(n), POSIX_FADV_WILLNEED);
+        else
+            job.fd = -1;
+
+        lock.lock();
+
+        if( job.fd < 0 ) {
+            ahead_ -= n;
+            n = 0;
+        }
+
+        ready_.emplace_back(std::move(job));
+        advised_.push_back(n);
+    }
+
+    advising_ = false;
+#else
+    (void) lock;
+#endif
+}
+//------------------------------------------------------------------------------
+void file_hash_pipeline::hash(
+    file_hasher & hasher,
+    std::vector<file_hash_job> & batch,
+    const file_hasher::completion & done,
+    bool * p_shutdown)
+{
+    // descriptors are left in jobs not reached by hasher
+    at_scope_exit(
+        for( auto & job : batch )
+            if( job.fd >= 0 )
+                file_hasher::close(job.fd);
+
+        batch.clear();
+    );
+
+    uint64_t bytes = 0;
+
+    for( const auto & job : batch )
+        bytes += job.file_size;
+
+    auto started = clock_gettime_ns();
+
+    hasher.hash(batch, done, p_shutdown);
+
+    auto ns = clock_gettime_ns() - started;
+
+    if( ns == 0 )
+        return;
+
+    auto rate = uint64_t(double(bytes) * 1000000000. / double(ns));
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    rate_ = rate_ == 0 ? rate : (rate_ * 7 + rate) / 8;
+}
+//------------------------------------------------------------------------------
+void file_hash_pipeline::discard()
+{
+    for( auto & job : ready_ )
+        if( job.fd >= 0 )
+            file_hasher::close(job.fd);
+
+    ready_.clear();
+    advised_.clear();
+    queue_.clear();
+    ahead_ = 0;
+}
+//------------------------------------------------------------------------------
+void file_hash_pipeline::flush(const file_hasher::completion & done)
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+    std::vector<file_hash_job> batch;
+
+    pending_ = 0;
+    pending_size_ = 0;
+
+    while( !shutdown() && (!queue_.empty() || !ready_.empty()) ) {
+        take(batch, queue_.size() + ready_.size());
+        advise(lock);
+        lock.unlock();
+        at_scope_exit( lock.lock() );
+
+        hash(*hasher_, batch, done, p_shutdown_);
+    }
+
+    discard();
+}
+//------------------------------------------------------------------------------
+void file_hash_pipeline::push(file_hash_job && job, const file_hasher::completion & done)
+{
+    if( threads_ == 0 ) {
+        pending_++;
+        pending_size_ += job.file_size;
+        queue_.emplace_back(std::move(job));
+
+        if( pending_ >= std::min(max_pending_, size_t(256)) || pending_size_ >= max_pending_size_ )
+            flush(done);
+
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mtx_);
+
+    for(;;) {
+        deliver(lock, done);
+
+        if( shutdown() || abort_ ) {
+            stop(lock);
+            return;
+        }
+
+        if( pending_ < max_pending_ && pending_size_ < max_pending_size_ )
+            break;
+
+        // wake up periodically to notice shutdown
+        writer_cv_.wait_for(lock, std::chrono::milliseconds(100), [&] {
+            return !results_.empty() || error_;
+        });
+    }
+
+    pending_++;
+    pending_size_ += job.file_size;
+    queue_.emplace_back(std::move(job));
+
+    lock.unlock();
+    workers_cv_.notify_one();
+}
+//------------------------------------------------------------------------------
+void file_hash_pipeline::drain(const file_hasher::completion & done)
+{
+    if( threads_ == 0 )
+        return;
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    deliver(lock, done);
+}
+//------------------------------------------------------------------------------
+void file_hash_pipeline::finish(const file_hasher::completion & done)
+{
+    if( threads_ == 0 ) {
+        flush(done);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mtx_);
+
+    for(;;) {
+        deliver(lock, done);
+
+        if( pending_ == 0 )
+            break;
+
+        if( shutdown() || abort_ ) {
+            stop(lock);
+            break;
+        }
+
+        writer_cv_.wait_for(lock, std::chrono::milliseconds(100), [&] {
+            return !results_.empty() || error_;
+        });
+    }
+}
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
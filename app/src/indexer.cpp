@@ -24,16 +24,30 @@
 //------------------------------------------------------------------------------
 #include "config.h"
 //------------------------------------------------------------------------------
-#include <stack>
+#include <cstring>
+#include <iostream>
+#include <deque>
+#include <set>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
 #include <regex>
+#if HAVE_GETDENTS64
+#   include <sys/syscall.h>
+#   include <sys/sysmacros.h>
+#endif
 #if QT_CORE_LIB
 #   include <QString>
-#   include <QRegExp>
 #endif
 //------------------------------------------------------------------------------
 #include "port.hpp"
 #include "std_ext.hpp"
 #include "cdc512.hpp"
+#include "thread_pool.hpp"
+#include "hasher.hpp"
+#include "hash_cache.hpp"
+#include "glob.hpp"
+#include "sequence.hpp"
 #include "indexer.hpp"
 //------------------------------------------------------------------------------
 namespace homeostas {
@@ -160,841 +174,2488 @@ struct file_stat :
 //------------------------------------------------------------------------------
 ////////////////////////////////////////////////////////////////////////////////
 //------------------------------------------------------------------------------
-void directory_reader::read(const std::string & root_path)
+#if HAVE_GETDENTS64
+//------------------------------------------------------------------------------
+struct linux_dirent64 {
+    ino64_t         d_ino;
+    off64_t         d_off;
+    unsigned short  d_reclen;
+    unsigned char   d_type;
+    char            d_name[];
+};
+//------------------------------------------------------------------------------
+// fills only what indexer uses, returns errno
+static int stat_at(int dirfd, const char * name, directory_entry & e)
 {
-    struct stack_entry {
-#if _WIN32
-        HANDLE handle;
-#else
-        DIR * handle;
+#if defined(STATX_BASIC_STATS)
+    static std::atomic<bool> no_statx = { false };
+
+    if( !no_statx ) {
+        struct statx stx;
+
+        if( ::statx(dirfd, name, AT_NO_AUTOMOUNT,
+                STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME | STATX_CTIME | STATX_INO | STATX_NLINK, &stx) == 0 ) {
+            e.mtime = stx.stx_mtime.tv_sec;
+            e.mtime_ns = stx.stx_mtime.tv_nsec;
+            e.ctime = stx.stx_ctime.tv_sec;
+            e.ctime_ns = stx.stx_ctime.tv_nsec;
+            e.fsize = stx.stx_size;
+            e.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+            e.ino = stx.stx_ino;
+            e.nlink = stx.stx_nlink;
+            e.is_reg = S_ISREG(stx.stx_mode);
+            e.is_dir = S_ISDIR(stx.stx_mode);
+            e.is_lnk = S_ISLNK(stx.stx_mode);
+            return 0;
+        }
+
+        if( errno != ENOSYS )
+            return errno;
+
+        // kernel older than 4.11
+        no_statx = true;
+    }
 #endif
-        std::string path;
+    struct stat st;
+
+    if( ::fstatat(dirfd, name, &st, 0) != 0 )
+        return errno;
+
+    e.mtime = st.st_mtim.tv_sec;
+    e.mtime_ns = uint32_t(st.st_mtim.tv_nsec);
+    e.ctime = st.st_ctim.tv_sec;
+    e.ctime_ns = uint32_t(st.st_ctim.tv_nsec);
+    e.fsize = st.st_size;
+    e.dev = st.st_dev;
+    e.ino = st.st_ino;
+    e.nlink = st.st_nlink;
+    e.is_reg = S_ISREG(st.st_mode);
+    e.is_dir = S_ISDIR(st.st_mode);
+    e.is_lnk = S_ISLNK(st.st_mode);
+
+    return 0;
+}
+//------------------------------------------------------------------------------
+#endif
+//------------------------------------------------------------------------------
+struct directory_node {
+    enum {
+        Queued  = 0,
+        Claimed = 1,
+        Listed  = 2
     };
 
-    std::stack<stack_entry> stack;
-    QRegExp mask_regex(mask_.empty() ? ".*" : mask_.c_str());
-    QRegExp exclude_regex(exclude_.c_str());
+    struct item {
+        directory_entry entry;
+        std::shared_ptr<directory_node> child;
+        bool match;
+    };
 
-    path_ = root_path;
+    std::shared_ptr<directory_node> parent;
+    std::string path;
+    uintptr_t level;
+    glob_matcher::state mask_state = 0;     // states after path relative to root
+    glob_matcher::state exclude_state = 0;
+    bool resumed = false;   // on path to resume directory, items not delivered
+    std::atomic<int> state;
+    std::atomic<bool> cancelled;
+    std::vector<item> items;
+    std::exception_ptr error;
+
+    directory_node(const std::shared_ptr<directory_node> & a_parent, const std::string & a_path, uintptr_t a_level) :
+        parent(a_parent), path(a_path), level(a_level), state(Queued), cancelled(false) {}
+
+    bool claim() {
+        int expected = Queued;
+        return state.compare_exchange_strong(expected, Claimed);
+    }
 
-    if( path_.back() == path_delimiter[0] )
-        path_.pop_back();
+    bool is_cancelled() const {
+        for( auto p = this; p != nullptr; p = p->parent.get() )
+            if( p->cancelled )
+                return true;
 
-#if _WIN32
-	at_scope_exit(
-		while( !stack.empty() ) {
-			FindClose(stack.top().handle);
-			stack.pop();
-		}
-	);
-#else
-	at_scope_exit(
-		while( !stack.empty() ) {
-			::closedir(stack.top().handle);
-			stack.pop();
-		}
-	);
-#endif
+        return false;
+    }
+};
+//------------------------------------------------------------------------------
+// Every directory is listed as a whole by one of thread pool workers, listed
+// subdirectories go into the lister's own deque. Workers pop from the back of
+// its own deque and steal from the front of others. Calling thread delivers
+// listings to the manipulator in depth first order and lists a directory by
+// itself if nobody has claimed it yet.
+//------------------------------------------------------------------------------
+class directory_walker {
+public:
+    directory_walker(directory_reader & dr) :
+        dr_(dr), mask_(dr.mask_), exclude_(dr.exclude_), queues_(dr.threads_ + 1) {}
+
+    void walk(const std::string & root_path);
+protected:
+    typedef std::shared_ptr<directory_node> node_ptr;
+
+    struct queue {
+        std::mutex mtx;
+        std::deque<node_ptr> nodes;
+    };
 
-#if _WIN32
-    HANDLE handle = INVALID_HANDLE_VALUE;
-#else
-	DIR * handle = nullptr;
+    // per thread listing state
+    struct lister {
+        std::string path_name;
+#if HAVE_GETDENTS64
+        std::unique_ptr<uint8_t[]> dents;
 #endif
 
-    abort_ = false;
-
-	for(;;) {
-        if( abort_ )
-            break;
-#if _WIN32
-		DWORD err;
-		WIN32_FIND_DATAW fdw;
-#else
-		int err;
-		struct dirent * ent;
-#if HAVE_READDIR_R
-		struct dirent * result, res;
-		ent = &res;
-#endif
+        lister(const directory_reader &)
+#if HAVE_GETDENTS64
+            : dents(new uint8_t [dents_size])
 #endif
+        {
+        }
+    };
 
-#if _WIN32
-		if( handle == INVALID_HANDLE_VALUE ) {
-            handle = FindFirstFileW(QString::fromStdString(path_ + "\\*").toStdWString().c_str(), &fdw);
-#else
-		if( handle == nullptr ) {
-            handle = ::opendir(path_.c_str());
-#endif
-		}
-		else if( stack.empty() ) {
-			break;
-		}
-		else {
-			handle = stack.top().handle;
-            path_ = stack.top().path;
-			stack.pop();
-#if _WIN32
-            lstrcpyW(fdw.cFileName, L"");
+#if HAVE_GETDENTS64
+    static constexpr const size_t dents_size = 256 * 1024;
 #endif
-		}
 
-        level_ = stack.size() + 1;
-#if _WIN32
-		if( handle == INVALID_HANDLE_VALUE ) {
-			err = GetLastError();
-			if( err == ERROR_PATH_NOT_FOUND )
-				return;
-            throw std::xruntime_error(
-                "Failed to open directory: " + path_ + ", " + std::to_string(err), __FILE__, __LINE__);
+    // false if aborted while waiting for budget
+    bool throttle(uint64_t bytes, uint64_t ops) {
+        return dr_.throttle_ == nullptr || dr_.throttle_->acquire(bytes, ops, [&] {
+            return bool(dr_.abort_);
+        });
+    }
 
-#else
-		if( handle == nullptr ) {
-			err = errno;
-			if( err == ENOTDIR )
-				return;
-            throw std::xruntime_error("Failed to open directory: " + path_ + ", " + std::to_string(err), __FILE__, __LINE__);
-#endif
-		}
+    void read_directory(const node_ptr & n, lister & l);
+    void list(size_t q, const node_ptr & n, lister & l);
+    void push(size_t q, const std::vector<node_ptr> & nodes);
+    node_ptr pop(size_t q);
+    void worker(size_t q);
+
+    directory_reader & dr_;
+    const glob_matcher mask_;
+    const glob_matcher exclude_;
+    std::vector<queue> queues_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    size_t queued_ = 0;
+    size_t pending_ = 0;
+    bool finished_ = false;
+};
+//------------------------------------------------------------------------------
+void directory_walker::read_directory(const node_ptr & n, lister & l)
+{
+    // path and path_name of entry are set on delivery
+    auto add = [&] (std::string && name, const auto & fill) {
+        directory_node::item it;
+        auto & e = it.entry;
 
-#if _WIN32
-		at_scope_exit(
-			if( handle != INVALID_HANDLE_VALUE )
-				FindClose(handle);
-		);
-#else
-		at_scope_exit(
-			if( handle != nullptr )
-				::closedir(handle);
-		);
-#endif
+        e.name = std::move(name);
+        e.level = n->level;
 
-#if _WIN32
-		do {
-            if( abort_ )
-                break;
+        if( !fill(e) )
+            return;
 
-			if( lstrcmpW(fdw.cFileName, L"") == 0 )
-				continue;
-            if( lstrcmpW(fdw.cFileName, L".") == 0 && !list_dot_ )
-				continue;
-            if( lstrcmpW(fdw.cFileName, L"..") == 0 && !list_dotdot_ )
-				continue;
-
-            name_ = QString::fromWCharArray(fdw.cFileName).toStdString();
-#elif HAVE_READDIR_R
-		for(;;) {
-			if( readdir_r(handle, ent, &result) != 0 ) {
-				err = errno;
-                throw std::xruntime_error("Failed to read directory: " + path_ + ", " + std::to_string(err), __FILE__, __LINE__);
-			}
-
-			if( result == nullptr )
-				break;
-
-            if( strcmp(ent->d_name, ".") == 0  && !list_dot_ )
-				continue;
-            if( strcmp(ent->d_name, "..") == 0 && !list_dotdot_ )
-				continue;
-
-            name_ = ent->d_name;
-#else
-		for(;;) {
-			errno = 0;
-			ent = readdir(handle);
-            err = errno;
+        // patterns are matched bytewise continuing from states of directory
+        auto mask_state = mask_.step(n->mask_state, e.name);
+        auto exclude_state = exclude_.step(n->exclude_state, e.name);
 
-			if( ent == nullptr ) {
-                if( err != 0 )
-                    throw std::xruntime_error("Failed to read directory: " + path_ + ", " + std::to_string(err), __FILE__, __LINE__);
-				break;
-			}
+        // excluded directory is pruned with its whole subtree, mask selects
+        // files only
+        bool excluded = exclude_.match(exclude_state, e.is_dir);
 
-            if( strcmp(ent->d_name, ".") == 0  && !list_dot_ )
-				continue;
-            if( strcmp(ent->d_name, "..") == 0 && !list_dotdot_ )
-				continue;
+        it.match = !excluded && (e.is_dir || mask_.empty() || mask_.match(mask_state, false));
 
-            name_ = ent->d_name;
-#endif
-            auto qname = QString::fromStdString(name_);
-            bool match = mask_regex.indexIn(qname) != -1;
+        bool descend = e.is_dir
+            && !excluded
+            && dr_.recursive_
+            && (dr_.max_level_ == 0 || n->level <= dr_.max_level_)
+            && e.name != "." && e.name != "..";
+
+        bool resumed = false;
+
+        // subdirectories of resume path before it are passed already
+        if( descend && n->resumed && n->path.size() < dr_.resume_.size() ) {
+            auto first = n->path.size() + 1;
+            auto last = dr_.resume_.find(path_delimiter[0], first);
+            auto r = dr_.resume_.compare(first, last == std::string::npos ? std::string::npos : last - first, e.name);
+
+            descend = r <= 0;
+            resumed = r == 0;
+        }
+
+        if( descend ) {
+            it.child = std::make_shared<directory_node>(n, n->path + path_delimiter + e.name, n->level + 1);
+            it.child->mask_state = mask_.step(mask_state, '/');
+            it.child->exclude_state = exclude_.step(exclude_state, '/');
+            it.child->resumed = resumed;
+        }
 
-            if( match && !exclude_.empty() )
-                match = exclude_regex.indexIn(qname) == -1;
+        if( e.is_dir ? descend || (it.match && dr_.list_directories_) : it.match )
+            n->items.emplace_back(std::move(it));
+    };
 
-            path_name_ = path_ + path_delimiter + name_;
+    if( !throttle(0, 1) )
+        return;
 
 #if _WIN32
-            fsize_ = fdw.nFileSizeHigh;
-            fsize_ <<= 32;
-            fsize_ |= fdw.nFileSizeLow;
-            is_reg_ = (fdw.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0;
-            is_dir_ = (fdw.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-            is_lnk_ = false;
-
-            atime_ = unpack_FILETIME(fdw.ftLastAccessTime, atime_ns_);
-            ctime_ = unpack_FILETIME(fdw.ftCreationTime, ctime_ns_);
-            mtime_ = unpack_FILETIME(fdw.ftLastWriteTime, mtime_ns_);
+    WIN32_FIND_DATAW fdw;
+    HANDLE handle = FindFirstFileW(QString::fromStdString(n->path + "\\*").toStdWString().c_str(), &fdw);
+
+    if( handle == INVALID_HANDLE_VALUE ) {
+        DWORD err = GetLastError();
+        if( err == ERROR_PATH_NOT_FOUND )
+            return;
+        throw std::xruntime_error(
+            "Failed to open directory: " + n->path + ", " + std::to_string(err), __FILE__, __LINE__);
+    }
+
+    at_scope_exit( FindClose(handle) );
+
+    do {
+        if( dr_.abort_ )
+            return;
+
+        if( lstrcmpW(fdw.cFileName, L"") == 0 )
+            continue;
+        if( lstrcmpW(fdw.cFileName, L".") == 0 && !dr_.list_dot_ )
+            continue;
+        if( lstrcmpW(fdw.cFileName, L"..") == 0 && !dr_.list_dotdot_ )
+            continue;
+
+        add(QString::fromWCharArray(fdw.cFileName).toStdString(), [&] (directory_entry & e) {
+            e.fsize = fdw.nFileSizeHigh;
+            e.fsize <<= 32;
+            e.fsize |= fdw.nFileSizeLow;
+            e.is_reg = (fdw.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0;
+            e.is_dir = (fdw.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            e.is_lnk = false;
+
+            e.atime = unpack_FILETIME(fdw.ftLastAccessTime, e.atime_ns);
+            e.ctime = unpack_FILETIME(fdw.ftCreationTime, e.ctime_ns);
+            e.mtime = unpack_FILETIME(fdw.ftLastWriteTime, e.mtime_ns);
+            return true;
+        });
+    }
+    while( FindNextFileW(handle, &fdw) != 0 );
+
+    DWORD err = GetLastError();
+
+    if( err != ERROR_NO_MORE_FILES && !dr_.abort_ )
+        throw std::xruntime_error(
+            "Failed to read directory: " + n->path + ", " + std::to_string(err), __FILE__, __LINE__);
+#elif HAVE_GETDENTS64
+    // raw directory records read in large chunks, entries stated relative
+    // to directory descriptor, so no full path resolution per entry
+    int fd = ::open(n->path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if( fd == -1 ) {
+        int err = errno;
+        if( err == ENOTDIR )
+            return;
+        throw std::xruntime_error("Failed to open directory: " + n->path + ", " + std::to_string(err), __FILE__, __LINE__);
+    }
+
+    at_scope_exit( ::close(fd) );
+
+    for(;;) {
+        if( dr_.abort_ )
+            break;
+
+        auto r = ::syscall(SYS_getdents64, fd, l.dents.get(), dents_size);
+
+        if( r == -1 ) {
+            int err = errno;
+            throw std::xruntime_error("Failed to read directory: " + n->path + ", " + std::to_string(err), __FILE__, __LINE__);
+        }
+
+        if( r == 0 )
+            break;
+
+        // size is known after read, so charged for the next one
+        if( !throttle(uint64_t(r), 1) )
+            break;
+
+        for( decltype(r) offset = 0; offset < r; ) {
+            auto ent = reinterpret_cast<const linux_dirent64 *>(l.dents.get() + offset);
+            offset += ent->d_reclen;
+
+            if( strcmp(ent->d_name, ".") == 0  && !dr_.list_dot_ )
+                continue;
+            if( strcmp(ent->d_name, "..") == 0 && !dr_.list_dotdot_ )
+                continue;
+
+            add(ent->d_name, [&] (directory_entry & e) {
+                int err = stat_at(fd, ent->d_name, e);
+
+                // entry removed after directory was read
+                if( err == ENOENT )
+                    return false;
+
+                if( err != 0 )
+                    throw std::xruntime_error("Failed to read file info: "
+                        + n->path + path_delimiter + e.name + ", " + std::to_string(err), __FILE__, __LINE__);
+
+                return true;
+            });
+        }
+    }
 #else
-            file_stat fs(path_name_);
+    DIR * handle = ::opendir(n->path.c_str());
+
+    if( handle == nullptr ) {
+        int err = errno;
+        if( err == ENOTDIR )
+            return;
+        throw std::xruntime_error("Failed to open directory: " + n->path + ", " + std::to_string(err), __FILE__, __LINE__);
+    }
+
+    at_scope_exit( ::closedir(handle) );
 
-			if( (err = errno) != 0 )
-                throw std::xruntime_error("Failed to read file info: " + path_name_ + ", " + std::to_string(err), __FILE__, __LINE__);
+    auto fill = [&] (directory_entry & e) {
+        l.path_name.assign(n->path).append(path_delimiter).append(e.name);
+        file_stat fs(l.path_name);
 
-			//if( (fs.st_mode & type_mask) == 0 )
-			//	continue;
-            atime_ = fs.st_atime;
-            ctime_ = fs.st_ctime;
-            mtime_ = fs.st_mtime;
+        e.atime = fs.st_atime;
+        e.ctime = fs.st_ctime;
+        e.mtime = fs.st_mtime;
 #if __USE_XOPEN2K8
-            atime_ns_ = fs.st_atim.tv_nsec;
-            ctime_ns_ = fs.st_ctim.tv_nsec;
-            mtime_ns_ = fs.st_mtim.tv_nsec;
+        e.atime_ns = uint32_t(fs.st_atim.tv_nsec);
+        e.ctime_ns = uint32_t(fs.st_ctim.tv_nsec);
+        e.mtime_ns = uint32_t(fs.st_mtim.tv_nsec);
 #else
-            atime_ns_ = fs.st_atimensec;
-            ctime_ns_ = fs.st_ctimensec;
-            mtime_ns_ = fs.st_mtimensec;
+        e.atime_ns = uint32_t(fs.st_atimensec);
+        e.ctime_ns = uint32_t(fs.st_ctimensec);
+        e.mtime_ns = uint32_t(fs.st_mtimensec);
 #endif
-            fsize_ = fs.st_size;
-            is_reg_ = S_ISREG(fs.st_mode);
-            is_dir_ = S_ISDIR(fs.st_mode);
-            is_lnk_ = S_ISLNK(fs.st_mode);
-#endif
-#if _WIN32
-			if( (fdw.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 ) {
-#elif __USE_MISC
-//&& DT_UNKNOWN && DT_DIR && IFTODT
-            auto d_type = ent->d_type;
+        e.fsize = fs.st_size;
+        e.dev = fs.st_dev;
+        e.ino = fs.st_ino;
+        e.nlink = fs.st_nlink;
+        e.is_reg = S_ISREG(fs.st_mode);
+        e.is_dir = S_ISDIR(fs.st_mode);
+        e.is_lnk = S_ISLNK(fs.st_mode);
+        return true;
+    };
 
-			if( d_type == DT_UNKNOWN ) {
-                struct stat st;
+    for(;;) {
+        if( dr_.abort_ )
+            break;
 
-                if( ::stat(path_name_.c_str(), &st) != 0 ) {
-                    err = errno;
-                    throw std::xruntime_error("Failed to stat entry: " + path_name_ + ", " + std::to_string(err), __FILE__, __LINE__);
-                }
+        int err;
+        struct dirent * ent;
+#if HAVE_READDIR_R
+        struct dirent * result, res;
+        ent = &res;
 
-                d_type = IFTODT(st.st_mode);
-			}
+        if( readdir_r(handle, ent, &result) != 0 ) {
+            err = errno;
+            throw std::xruntime_error("Failed to read directory: " + n->path + ", " + std::to_string(err), __FILE__, __LINE__);
+        }
 
-			if( d_type == DT_DIR ) {
+        if( result == nullptr )
+            break;
 #else
-			struct stat st;
+        errno = 0;
+        ent = readdir(handle);
+        err = errno;
 
-            if( ::stat(path_name_.c_str(), &st) != 0 ) {
-				err = errno;
-                throw std::xruntime_error("Failed to stat entry: " + path_name_ + ", " + std::to_string(err), __FILE__, __LINE__);
-			}
+        if( ent == nullptr ) {
+            if( err != 0 )
+                throw std::xruntime_error("Failed to read directory: " + n->path + ", " + std::to_string(err), __FILE__, __LINE__);
+            break;
+        }
+#endif
+        if( strcmp(ent->d_name, ".") == 0  && !dr_.list_dot_ )
+            continue;
+        if( strcmp(ent->d_name, "..") == 0 && !dr_.list_dotdot_ )
+            continue;
 
-			if( (st.st_mode & S_IFDIR) != 0 ) {
+        add(ent->d_name, fill);
+    }
 #endif
+}
+//------------------------------------------------------------------------------
+void directory_walker::list(size_t q, const node_ptr & n, lister & l)
+{
+    try {
+        read_directory(n, l);
+    }
+    catch( ... ) {
+        n->error = std::current_exception();
+    }
 
-                if( list_directories_ && match && manipulator_ )
-                    manipulator_();
+    // deterministic order of entries in directory
+    std::sort(n->items.begin(), n->items.end(), [] (const auto & a, const auto & b) {
+        return a.entry.name < b.entry.name;
+    });
 
-                if( skip_ ) {
-                    skip_ = false;
-                    break;
-                }
+    // reversed, so first by name subdirectory popped first from the back
+    std::vector<node_ptr> childs;
 
-                if( recursive_ && (max_level_ == 0 || stack.size() < max_level_ ) ) {
-                    stack.push({ handle, path_ });
-                    path_ += path_delimiter + name_;
-#if _WIN32
-					handle = INVALID_HANDLE_VALUE;
-#else
-					handle = nullptr;
-#endif
-					break;
-				}
-			}
-			else if( match ) {
-                if( manipulator_ )
-                    manipulator_();
-			}
-		}
-#if _WIN32
-		while( FindNextFileW(handle, &fdw) != 0 );
+    for( auto i = n->items.rbegin(); i != n->items.rend(); i++ )
+        if( i->child != nullptr )
+            childs.push_back(i->child);
 
-        if( handle != INVALID_HANDLE_VALUE
-                && (err = GetLastError()) != ERROR_NO_MORE_FILES
-                && !abort_ )
-            throw std::xruntime_error(
-                "Failed to read directory: " + path_ + ", " + std::to_string(err), __FILE__, __LINE__);
-#endif
-	}
-};
+    std::unique_lock<std::mutex> lk(mtx_);
+    n->state = directory_node::Listed;
+    pending_ += n->items.size();
+    lk.unlock();
+
+    if( dr_.threads_ != 0 )
+        push(q, childs);
+
+    cv_.notify_all();
+}
 //------------------------------------------------------------------------------
-////////////////////////////////////////////////////////////////////////////////
+void directory_walker::push(size_t q, const std::vector<node_ptr> & nodes)
+{
+    if( nodes.empty() )
+        return;
+
+    std::unique_lock<std::mutex> qlk(queues_[q].mtx);
+    queues_[q].nodes.insert(queues_[q].nodes.end(), nodes.begin(), nodes.end());
+    qlk.unlock();
+
+    std::unique_lock<std::mutex> lk(mtx_);
+    queued_ += nodes.size();
+}
 //------------------------------------------------------------------------------
-void directory_indexer::reindex(
-    sqlite3pp::database & db,
-    const std::string & dir_path_name,
-    bool * p_shutdown)
+directory_walker::node_ptr directory_walker::pop(size_t q)
 {
-    auto exceptions_safe = db.exceptions();
-    at_scope_exit( db.exceptions(exceptions_safe) );
-    db.exceptions(true);
+    for(;;) {
+        node_ptr n;
 
-    db.execute_all(R"EOS(
-        /*CREATE TABLE IF NOT EXISTS rowids (
-            id              INTEGER PRIMARY KEY ON CONFLICT REPLACE,
-            counter    		INTEGER NOT NULL
-        ) WITHOUT ROWID;*/
+        // own deque first, then try to steal from others
+        for( size_t i = 0; i < queues_.size() && n == nullptr; i++ ) {
+            auto & queue = queues_[(q + i) % queues_.size()];
+            std::unique_lock<std::mutex> qlk(queue.mtx);
 
-        CREATE TABLE IF NOT EXISTS entries (
-            id              INTEGER PRIMARY KEY ON CONFLICT ABORT,
-            parent_id		INTEGER NOT NULL,   /* link on entries id */
-            is_alive		INTEGER NOT NULL,   /* boolean */
-            name			TEXT NOT NULL,      /* file name */
-            is_dir			INTEGER,            /* boolean */
-            mtime			INTEGER,            /* nanoseconds */
-            file_size		INTEGER,            /* file size in bytes */
-            block_size		INTEGER,            /* file block size in bytes */
-            digest			BLOB                /* file checksum, or snap key for root */
-            UNIQUE(parent_id, name) ON CONFLICT ABORT
-        ) WITHOUT ROWID;
+            if( queue.nodes.empty() )
+                continue;
 
-        CREATE UNIQUE INDEX IF NOT EXISTS i1 ON entries (parent_id, name);
-        CREATE INDEX IF NOT EXISTS i2 ON entries (is_alive);
+            if( i == 0 ) {
+                n = std::move(queue.nodes.back());
+                queue.nodes.pop_back();
+            }
+            else {
+                n = std::move(queue.nodes.front());
+                queue.nodes.pop_front();
+            }
+        }
 
-        CREATE TABLE IF NOT EXISTS blocks_digests (
-            entry_id		INTEGER NOT NULL,   /* link on entries rowid */
-            block_no		INTEGER NOT NULL,   /* file block number starting from one */
-            mtime			INTEGER,            /* nanoseconds */
-            digest			BLOB,               /* file block checksum */
-            UNIQUE(entry_id, block_no) ON CONFLICT ABORT
-        )/*WITHOUT ROWID*/;
-        CREATE UNIQUE INDEX IF NOT EXISTS i3 ON blocks_digests (entry_id, block_no);
+        if( n == nullptr )
+            return n;
 
-        CREATE TABLE IF NOT EXISTS remote_trackers (
-            key             BLOB PRIMARY KEY ON CONFLICT ABORT, /* remote tracker host public key */
-            mtime			INTEGER NOT NULL                    /* nanoseconds */
-        ) WITHOUT ROWID;
+        std::unique_lock<std::mutex> lk(mtx_);
+        queued_--;
+        lk.unlock();
 
-        CREATE TABLE IF NOT EXISTS remote_tracking (
-            key             BLOB NOT NULL,      /* remote tracker host public key */
-            entry_id        INTEGER NOT NULL,   /* link on entries rowid */
-            block_no		INTEGER NOT NULL,   /* file block number starting from one */
-            deleted         INTEGER
-            UNIQUE(entry_id, block_no, key) ON CONFLICT REPLACE
-        ) /*WITHOUT ROWID*/;
-        CREATE UNIQUE INDEX IF NOT EXISTS i4 ON remote_tracking (entry_id, block_no, key);
-        CREATE INDEX IF NOT EXISTS i5 ON remote_tracking (entry_id);
-        CREATE INDEX IF NOT EXISTS i6 ON remote_tracking (entry_id, block_no);
+        // may be already claimed by manipulator thread or skipped by manipulator
+        if( !n->is_cancelled() && n->claim() )
+            return n;
+    }
+}
+//------------------------------------------------------------------------------
+void directory_walker::worker(size_t q)
+{
+    lister l(dr_);
 
-        CREATE TRIGGER IF NOT EXISTS entries_after_delete_trigger
-            AFTER DELETE
-            ON entries FOR EACH ROW
-        BEGIN
-            /*DELETE FROM remote_tracking WHERE entry_id = old.id;*/
-            DELETE FROM blocks_digests WHERE entry_id = old.id;
-        END;
+    // pool thread serves others after, so its class is restored
+    int io_priority = dr_.throttle_ != nullptr && dr_.throttle_->idle_priority() ? enter_idle_io_priority() : -1;
+    at_scope_exit( leave_idle_io_priority(io_priority) );
 
-        CREATE TRIGGER IF NOT EXISTS blocks_digests_after_delete_trigger
-            AFTER DELETE
-            ON blocks_digests FOR EACH ROW
-        BEGIN
-            REPLACE INTO remote_tracking
-                SELECT
-                    key, old.entry_id, old.block_no, 1
-               FROM
-                   remote_trackers
-            /*DELETE FROM remote_tracking WHERE entry_id = old.entry_id AND block_no = old.block_no;*/
-        END;
+    for(;;) {
+        auto n = pop(q);
 
-        CREATE TRIGGER IF NOT EXISTS remote_trackers_after_insert_trigger
-            AFTER INSERT
-            ON remote_trackers FOR EACH ROW
-        BEGIN
-            REPLACE INTO remote_tracking
-                SELECT
-                    new.key, entry_id, block_no, NULL
-                FROM
-                    blocks_digests
-        END;
+        if( n != nullptr ) {
+            list(q, n, l);
+        }
 
-        CREATE TRIGGER IF NOT EXISTS remote_trackers_after_delete_trigger
-            AFTER DELETE
-            ON remote_trackers FOR EACH ROW
-        BEGIN
-            DELETE FROM remote_tracking WHERE key = old.key;
-        END;
-    )EOS");
+        std::unique_lock<std::mutex> lk(mtx_);
 
-    sqlite3pp::query row_next_id_st(db, R"EOS(
-        SELECT
-            id
-        FROM
-            entries
-        WHERE
-            id = :id
-        UNION ALL
-        SELECT
-            entry_id
-        FROM
-            remote_tracking
-        WHERE
-            entry_id = :id
-    )EOS");
+        cv_.wait(lk, [&] {
+            return finished_ || dr_.abort_ || (queued_ != 0 && pending_ < dr_.max_pending_);
+        });
 
-    uint64_t row_id;
+        if( finished_ || dr_.abort_ )
+            break;
+    }
+}
+//------------------------------------------------------------------------------
+void directory_walker::walk(const std::string & root_path)
+{
+    std::string path = root_path;
 
-    while( (row_id = entropy_fast()) == 0 );
+    if( !path.empty() && path.back() == path_delimiter[0] )
+        path.pop_back();
 
-    auto row_next_id = [&] {
-        at_scope_exit( row_next_id_st.reset() );
+    std::vector<std::shared_future<void>> workers;
 
-        for(;;) {
-            row_next_id_st.bind("id", row_id);
-            auto i = row_next_id_st.begin();
+    at_scope_exit(
+        std::unique_lock<std::mutex> lk(mtx_);
+        finished_ = true;
+        lk.unlock();
+        cv_.notify_all();
 
-            if( i ) {
-                while( (row_id = std::ihash<uint64_t>(std::rhash(row_id) + 1) ^ row_id) == 0 );
-            }
-            else
-                break;
-        }
+        for( auto & w : workers )
+            w.wait();
+    );
 
-        return row_id;
-    };
+    for( size_t q = 1; q <= dr_.threads_; q++ )
+        workers.emplace_back(thread_pool_t::instance()->enqueue(&directory_walker::worker, this, q));
 
-    sqlite3pp::query st_sel(db, R"EOS(
-        SELECT
-            id,
-            mtime,
-            digest
-        FROM
-            entries
-        WHERE
-            parent_id = :parent_id
-            AND name = :name
-    )EOS");
+    lister l(dr_);
+    std::vector<node_ptr> stack = { std::make_shared<directory_node>(nullptr, path, 1) };
+    stack.back()->mask_state = mask_.start();
+    stack.back()->exclude_state = exclude_.start();
+    stack.back()->resumed = dr_.resume_ == path
+        || dr_.resume_.compare(0, path.size() + 1, path + path_delimiter) == 0;
+    std::string path_buf, path_name_buf;
+    std::string path_name;
 
-	sqlite3pp::command st_ins(db, R"EOS(
-        INSERT INTO entries (
-            id, is_alive, parent_id, name, is_dir, mtime, file_size, block_size, digest
-        ) VALUES (:id, 0, :parent_id, :name, :is_dir, NULL, :file_size, :block_size, NULL)
+    while( !stack.empty() && !dr_.abort_ ) {
+        auto n = std::move(stack.back());
+        stack.pop_back();
+
+        if( n->claim() ) {
+            list(0, n, l);
+        }
+        else {
+            std::unique_lock<std::mutex> lk(mtx_);
+            cv_.wait(lk, [&] { return n->state == directory_node::Listed; });
+        }
+
+        if( n->error )
+            std::rethrow_exception(n->error);
+
+        auto childs_start = stack.size();
+
+        for( auto & it : n->items ) {
+            if( dr_.abort_ )
+                break;
+
+            if( it.match && (!it.entry.is_dir || dr_.list_directories_) && dr_.manipulator_ && !n->resumed ) {
+                auto & e = it.entry;
+
+                // lend reused buffers, no allocations per entry
+                e.path.swap(path_buf);
+                e.path_name.swap(path_name_buf);
+                at_scope_exit(
+                    e.path.swap(path_buf);
+                    e.path_name.swap(path_name_buf);
+                );
+
+                e.path.assign(n->path);
+                e.path_name.assign(n->path).append(path_delimiter).append(e.name);
+
+                dr_.manipulator_(e);
+            }
+
+            if( it.child != nullptr ) {
+                if( it.entry.skip )
+                    it.child->cancelled = true;
+                else
+                    stack.emplace_back(std::move(it.child));
+            }
+        }
+
+        if( !dr_.abort_ && !n->resumed && dr_.listed_ )
+            dr_.listed_(n->path, n->level);
+
+        // first by name subdirectory must be delivered first
+        std::reverse(stack.begin() + childs_start, stack.end());
+
+        std::unique_lock<std::mutex> lk(mtx_);
+        pending_ -= n->items.size();
+        lk.unlock();
+
+        n->items = decltype(n->items)();
+        cv_.notify_all();
+    }
+}
+//------------------------------------------------------------------------------
+void directory_reader::read(const std::string & root_path)
+{
+    abort_ = false;
+
+    directory_walker walker(*this);
+    walker.walk(root_path);
+}
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+// values keyed by directory path stored as trie of path components, every
+// name is kept once in arena blocks freed all at once with trie, paths are
+// looked up in place, so no path string is built or kept per directory
+template <typename T>
+class path_trie {
+public:
+    path_trie() : nodes_(1) {}
+
+    // value of path prefix of given size, nullptr if none
+    T * find(const std::string & path, size_t size = std::string::npos) {
+        auto n = lookup(path, std::min(size, path.size()), false);
+        return nodes_[n].valued ? &nodes_[n].value : nullptr;
+    }
+
+    // replaces value of path if any
+    T & insert(const std::string & path, const T & value, size_t size = std::string::npos) {
+        auto & node = nodes_[lookup(path, std::min(size, path.size()), true)];
+        node.valued = true;
+        node.value = value;
+        return node.value;
+    }
+protected:
+    static constexpr const size_t arena_block = 64 * 1024;
+
+    struct node {
+        bool valued = false;
+        T value;
+    };
+
+    // name points into arena or into looked up path
+    struct key {
+        uint32_t parent;
+        uint32_t size;
+        const char * name;
+    };
+
+    struct key_hash {
+        size_t operator () (const key & k) const {
+            // FNV-1a
+            uint64_t h = 0xcbf29ce484222325ull ^ k.parent;
+
+            for( uint32_t i = 0; i < k.size; i++ )
+                h = (h ^ uint8_t(k.name[i])) * 0x100000001b3ull;
+
+            return size_t(h);
+        }
+    };
+
+    struct key_equal {
+        bool operator () (const key & a, const key & b) const {
+            return a.parent == b.parent && a.size == b.size && std::memcmp(a.name, b.name, a.size) == 0;
+        }
+    };
+
+    // node zero is above roots, which are the first components of paths
+    std::deque<node> nodes_;
+    std::unordered_map<key, uint32_t, key_hash, key_equal> childs_;
+    std::vector<std::unique_ptr<char[]>> arena_;
+    char * arena_next_ = nullptr;
+    size_t arena_left_ = 0;
+
+    // consecutive entries are mostly of the same directory
+    std::string last_path_;
+    uint32_t last_ = 0;
+
+    const char * intern(const char * name, size_t size) {
+        if( size == 0 )
+            return "";
+
+        if( size > arena_left_ ) {
+            arena_left_ = std::max(size, arena_block);
+            arena_.emplace_back(new char [arena_left_]);
+            arena_next_ = arena_.back().get();
+        }
+
+        auto p = arena_next_;
+        std::memcpy(p, name, size);
+        arena_next_ += size;
+        arena_left_ -= size;
+
+        return p;
+    }
+
+    // node of path prefix, zero if it is absent and not created
+    uint32_t lookup(const std::string & path, size_t size, bool create) {
+        uint32_t n = 0;
+        size_t first = 0;
+
+        if( last_ != 0 && size >= last_path_.size() && path.compare(0, last_path_.size(), last_path_) == 0 ) {
+            if( size == last_path_.size() )
+                return last_;
+
+            if( path[last_path_.size()] == path_delimiter[0] ) {
+                n = last_;
+                first = last_path_.size() + 1;
+            }
+        }
+
+        for(;;) {
+            auto last = std::min(path.find(path_delimiter[0], first), size);
+            key k = { n, uint32_t(last - first), path.data() + first };
+            auto i = childs_.find(k);
+
+            if( i != childs_.end() ) {
+                n = i->second;
+            }
+            else if( !create ) {
+                return 0;
+            }
+            else {
+                k.name = intern(k.name, k.size);
+                n = uint32_t(nodes_.size());
+                nodes_.emplace_back();
+                childs_.emplace(k, n);
+            }
+
+            if( last == size )
+                break;
+
+            first = last + 1;
+        }
+
+        // inserted paths are mostly subdirectories of looked up one
+        if( !create ) {
+            last_path_.assign(path, 0, size);
+            last_ = n;
+        }
+
+        return n;
+    }
+};
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+uint64_t directory_indexer::block_size(uint64_t file_size) const
+{
+    // null block size marks content defined chunks
+    if( chunk_avg_ != 0 )
+        return 0;
+
+    uint64_t block_size = min_block_size_;
+
+    while( block_size < max_block_size_ && block_size * 1024 < file_size )
+        block_size <<= 1;
+
+    return block_size;
+}
+//------------------------------------------------------------------------------
+void directory_indexer::reindex_paths(
+    sqlite3pp::database & db,
+    const std::string & dir_path_name,
+    const dirty_paths * p_paths,
+    bool * p_shutdown)
+{
+    auto exceptions_safe = db.exceptions();
+    at_scope_exit( db.exceptions(exceptions_safe) );
+    db.exceptions(true);
+
+    auto table_has_column = [&] (const char * table, const char * column) {
+        sqlite3pp::query st(db, (std::string("PRAGMA table_info(") + table + ")").c_str());
+
+        for( auto i = st.begin(); i; i++ )
+            if( std::strcmp(i->get<const char *>("name"), column) == 0 )
+                return true;
+
+        return false;
+    };
+
+    // databases created before scan generations carry is_alive flag, sqlite
+    // can not drop column so entries are moved to table of new layout,
+    // indexes and triggers of old table are recreated below
+    if( table_has_column("entries", "is_alive") ) {
+        sqlite3pp::transaction tx(&db, true, true);
+
+        db.execute_all(R"EOS(
+            CREATE TABLE entries_v2 (
+                id              INTEGER PRIMARY KEY ON CONFLICT ABORT,
+                parent_id		INTEGER NOT NULL,
+                generation		INTEGER NOT NULL,
+                name			TEXT NOT NULL,
+                is_dir			INTEGER,
+                mtime			INTEGER,
+                file_size		INTEGER,
+                block_size		INTEGER,
+                digest			BLOB,
+                dev				INTEGER,
+                ino				INTEGER,
+                UNIQUE(parent_id, name) ON CONFLICT ABORT
+            ) WITHOUT ROWID;
+
+            INSERT INTO entries_v2
+                SELECT
+                    id, parent_id, 0, name, is_dir, mtime, file_size, block_size, digest, NULL, NULL
+                FROM
+                    entries;
+
+            DROP TABLE entries;
+            ALTER TABLE entries_v2 RENAME TO entries;
+        )EOS");
+
+        tx.commit();
+        tx.release();
+    }
+
+    db.execute_all(R"EOS(
+        /*CREATE TABLE IF NOT EXISTS rowids (
+            id              INTEGER PRIMARY KEY ON CONFLICT REPLACE,
+            counter    		INTEGER NOT NULL
+        ) WITHOUT ROWID;*/
+
+        CREATE TABLE IF NOT EXISTS entries (
+            id              INTEGER PRIMARY KEY ON CONFLICT ABORT,
+            parent_id		INTEGER NOT NULL,   /* link on entries id */
+            generation		INTEGER NOT NULL,   /* scan pass which last wrote entry */
+            name			TEXT NOT NULL,      /* file name */
+            is_dir			INTEGER,            /* boolean */
+            mtime			INTEGER,            /* nanoseconds */
+            file_size		INTEGER,            /* file size in bytes */
+            block_size		INTEGER,            /* file block size in bytes */
+            digest			BLOB,               /* file checksum, digest of childs for directory, snap key for root */
+            dev				INTEGER,            /* device and inode, to recognize moved entries */
+            ino				INTEGER,
+            UNIQUE(parent_id, name) ON CONFLICT ABORT
+        ) WITHOUT ROWID;
+
+        CREATE UNIQUE INDEX IF NOT EXISTS i1 ON entries (parent_id, name);
+        CREATE INDEX IF NOT EXISTS i2 ON entries (generation);
+
+        CREATE TABLE IF NOT EXISTS blocks_digests (
+            entry_id		INTEGER NOT NULL,   /* link on entries rowid */
+            block_no		INTEGER NOT NULL,   /* file block number starting from one */
+            mtime			INTEGER,            /* nanoseconds */
+            digest			BLOB,               /* file block checksum */
+            block_offset	INTEGER,            /* block position in file */
+            block_length	INTEGER,            /* block length, variable for content defined chunks */
+            hole			INTEGER,            /* boolean, block of zeros, recreated by peer as hole instead of transfer */
+            UNIQUE(entry_id, block_no) ON CONFLICT ABORT
+        )/*WITHOUT ROWID*/;
+        CREATE UNIQUE INDEX IF NOT EXISTS i3 ON blocks_digests (entry_id, block_no);
+
+        CREATE TABLE IF NOT EXISTS checkpoints (
+            root_path       TEXT PRIMARY KEY ON CONFLICT REPLACE, /* path passed to reindex */
+            generation      INTEGER NOT NULL,   /* generation of interrupted full pass */
+            path            TEXT NOT NULL       /* last directory of it stored whole */
+        ) WITHOUT ROWID;
+
+        CREATE TABLE IF NOT EXISTS remote_trackers (
+            key             BLOB PRIMARY KEY ON CONFLICT ABORT, /* remote tracker host public key */
+            mtime			INTEGER NOT NULL                    /* nanoseconds */
+        ) WITHOUT ROWID;
+
+        CREATE TABLE IF NOT EXISTS remote_tracking (
+            key             BLOB NOT NULL,      /* remote tracker host public key */
+            entry_id        INTEGER NOT NULL,   /* link on entries rowid */
+            block_no		INTEGER NOT NULL,   /* file block number starting from one */
+            deleted         INTEGER,
+            UNIQUE(entry_id, block_no, key) ON CONFLICT REPLACE
+        ) /*WITHOUT ROWID*/;
+        CREATE UNIQUE INDEX IF NOT EXISTS i4 ON remote_tracking (entry_id, block_no, key);
+        CREATE INDEX IF NOT EXISTS i5 ON remote_tracking (entry_id);
+        CREATE INDEX IF NOT EXISTS i6 ON remote_tracking (entry_id, block_no);
+
+        CREATE TRIGGER IF NOT EXISTS entries_after_delete_trigger
+            AFTER DELETE
+            ON entries FOR EACH ROW
+        BEGIN
+            /*DELETE FROM remote_tracking WHERE entry_id = old.id;*/
+            DELETE FROM blocks_digests WHERE entry_id = old.id;
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS blocks_digests_after_delete_trigger
+            AFTER DELETE
+            ON blocks_digests FOR EACH ROW
+        BEGIN
+            REPLACE INTO remote_tracking
+                SELECT
+                    key, old.entry_id, old.block_no, 1
+               FROM
+                   remote_trackers;
+            /*DELETE FROM remote_tracking WHERE entry_id = old.entry_id AND block_no = old.block_no;*/
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS remote_trackers_after_insert_trigger
+            AFTER INSERT
+            ON remote_trackers FOR EACH ROW
+        BEGIN
+            REPLACE INTO remote_tracking
+                SELECT
+                    new.key, entry_id, block_no, NULL
+                FROM
+                    blocks_digests;
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS remote_trackers_after_delete_trigger
+            AFTER DELETE
+            ON remote_trackers FOR EACH ROW
+        BEGIN
+            DELETE FROM remote_tracking WHERE key = old.key;
+        END;
+    )EOS");
+
+    // databases created before content defined chunking lack block position
+    if( !table_has_column("blocks_digests", "block_offset") )
+        db.execute_all(R"EOS(
+            ALTER TABLE blocks_digests ADD COLUMN block_offset INTEGER;
+            ALTER TABLE blocks_digests ADD COLUMN block_length INTEGER;
+        )EOS");
+
+    // and before sparse files awareness zero blocks marks, already stored
+    // blocks of zeros are marked by their digests for every block size in
+    // single scan, digest of zeros differs with length, so it tells length
+    if( !table_has_column("blocks_digests", "hole") ) {
+        db.execute("ALTER TABLE blocks_digests ADD COLUMN hole INTEGER");
+
+        std::vector<std::key512> digests;
+        std::string params;
+
+        // as block_size() grows it
+        for( auto size = min_block_size_; size <= max_block_size_; size <<= 1 ) {
+            params.append(params.empty() ? "" : ", ").append(":d").append(std::to_string(digests.size()));
+            digests.emplace_back(zero_block_digest(size));
+        }
+
+        sqlite3pp::command st(db, "UPDATE blocks_digests SET hole = 1 WHERE digest IN (" + params + ")");
+
+        for( size_t i = 0; i < digests.size(); i++ )
+            st.bind("d" + std::to_string(i), digests[i].data(), int(sizeof(digests[i])), sqlite3pp::nocopy);
+
+        st.execute();
+    }
+
+    // and before rename detection inode of entry
+    if( !table_has_column("entries", "ino") )
+        db.execute_all(R"EOS(
+            ALTER TABLE entries ADD COLUMN dev INTEGER;
+            ALTER TABLE entries ADD COLUMN ino INTEGER;
+        )EOS");
+
+    db.execute("CREATE INDEX IF NOT EXISTS i7 ON entries (ino)");
+    // directories with stale digests, all of them on first pass after upgrade
+    db.execute("CREATE INDEX IF NOT EXISTS i8 ON entries (parent_id) WHERE is_dir IS NOT NULL AND digest IS NULL");
+
+    id_sequence entries_ids(db, "entries");
+
+    std::string root_path = dir_path_name;
+
+    if( !root_path.empty() && root_path.back() == path_delimiter[0] )
+        root_path.pop_back();
+
+    // interrupted full pass is resumed by the next one with its generation
+    std::string resume_path;
+    uint64_t generation = 0;
+
+    if( p_paths == nullptr && resumable_ ) {
+        sqlite3pp::query st(db, R"EOS(
+            SELECT generation, path FROM checkpoints WHERE root_path = :root_path
+        )EOS");
+        st.bind("root_path", root_path, sqlite3pp::nocopy);
+
+        auto i = st.begin();
+
+        if( i ) {
+            generation = i->get<uint64_t>("generation");
+            resume_path = i->get<const char *>("path");
+        }
+    }
+
+    // every pass stamps rows it writes with its own generation, unchanged
+    // entries are left as they are
+    if( generation == 0 )
+        generation = id_sequence(db, "generations", 1).next();
+
+    sqlite3pp::query st_sel(db, R"EOS(
+        SELECT
+            id,
+            mtime,
+            block_size,
+            digest,
+            ino
+        FROM
+            entries
+        WHERE
+            parent_id = :parent_id
+            AND name = :name
+    )EOS");
+
+	sqlite3pp::command st_ins(db, R"EOS(
+        INSERT INTO entries (
+            id, generation, parent_id, name, is_dir, mtime, file_size, block_size, digest, dev, ino
+        ) VALUES (:id, :generation, :parent_id, :name, :is_dir, NULL, :file_size, :block_size, NULL, :dev, :ino)
 	)EOS");
 	
+    sqlite3pp::query st_sel_childs(db, R"EOS(
+        SELECT
+            id,
+            name,
+            is_dir,
+            mtime,
+            file_size,
+            block_size,
+            digest,
+            ino
+        FROM
+            entries
+        WHERE
+            parent_id = :parent_id
+        ORDER BY
+            name
+    )EOS");
+
+    sqlite3pp::command st_del_subtree(db, R"EOS(
+        DELETE FROM entries WHERE id IN (
+            WITH RECURSIVE subtree(id) AS (
+                SELECT :id
+                UNION ALL
+                SELECT
+                    e.id
+                FROM
+                    entries AS e
+                        JOIN subtree AS s
+                        ON e.parent_id = s.id
+            )
+            SELECT id FROM subtree
+        )
+    )EOS");
+
 	sqlite3pp::command st_upd(db, R"EOS(
         UPDATE entries SET
-            is_alive = 0,
+            generation = :generation,
             parent_id = :parent_id,
             name = :name,
             is_dir = :is_dir,
             file_size = :file_size,
             block_size = :block_size,
-            digest = NULL
+            digest = NULL,
+            dev = :dev,
+            ino = :ino
 		WHERE
             parent_id = :parent_id
             AND name = :name
 	)EOS");
 
-    sqlite3pp::command st_upd_touch(db, R"EOS(
+    sqlite3pp::command st_upd_ino(db, R"EOS(
+        UPDATE entries SET
+            dev = :dev,
+            ino = :ino
+        WHERE
+            id = :id
+    )EOS");
+
+    // stored entries having inode of new one, candidates for moved entry
+    sqlite3pp::query st_sel_ino(db, R"EOS(
+        SELECT
+            id,
+            parent_id,
+            is_dir,
+            mtime,
+            file_size,
+            block_size,
+            dev
+        FROM
+            entries
+        WHERE
+            ino = :ino
+    )EOS");
+
+    sqlite3pp::command st_move(db, R"EOS(
         UPDATE entries SET
-            is_alive = 0
+            generation = :generation,
+            parent_id = :parent_id,
+            name = :name
         WHERE
             id = :id
     )EOS");
 
     sqlite3pp::command st_upd_after(db, R"EOS(
         UPDATE entries SET
-            is_alive = 0,
+            generation = :generation,
             mtime = :mtime,
             digest = :digest
         WHERE
             id = :id
     )EOS");
 
-    sqlite3pp::query st_blk_sel(db, R"EOS(
-        SELECT
-            *
+    sqlite3pp::command st_upd_snap(db, R"EOS(
+        UPDATE entries SET
+            mtime = :mtime,
+            digest = :digest
+        WHERE
+            id = :id
+    )EOS");
+
+    sqlite3pp::command st_upd_dir(db, R"EOS(
+        UPDATE entries SET
+            digest = :digest
+        WHERE
+            id = :id
+    )EOS");
+
+    sqlite3pp::query st_sel_dir(db, R"EOS(
+        SELECT
+            parent_id,
+            digest
+        FROM
+            entries
+        WHERE
+            id = :id
+    )EOS");
+
+    // stale directories below root with number of their ancestors
+    sqlite3pp::query st_sel_stale(db, R"EOS(
+        WITH RECURSIVE chain(id, ancestor_id, depth) AS (
+            SELECT
+                id, parent_id, 0
+            FROM
+                entries
+            WHERE
+                is_dir IS NOT NULL
+                AND digest IS NULL
+                AND parent_id <> 0
+            UNION ALL
+            SELECT
+                c.id, e.parent_id, c.depth + 1
+            FROM
+                chain AS c
+                    JOIN entries AS e
+                    ON e.id = c.ancestor_id
+        )
+        SELECT id, MAX(depth) AS depth FROM chain GROUP BY id
+    )EOS");
+
+    // bindings survive statement reset
+    st_ins.bind("generation", generation);
+    st_upd.bind("generation", generation);
+    st_upd_after.bind("generation", generation);
+    st_move.bind("generation", generation);
+
+    sqlite3pp::query st_sel_digest(db, R"EOS(
+        SELECT
+            digest
+        FROM
+            entries
+        WHERE
+            id = :id
+            AND digest IS NOT NULL
+    )EOS");
+
+    sqlite3pp::query st_blk_sel(db, R"EOS(
+        SELECT
+            block_no,
+            digest,
+            block_offset,
+            block_length
         FROM
             blocks_digests
         WHERE
             entry_id = :entry_id
-            AND block_no = :block_no
+        ORDER BY
+            block_no
+    )EOS");
+
+    sqlite3pp::command st_blk_del(db, R"EOS(
+        DELETE FROM blocks_digests
+        WHERE
+            entry_id = :entry_id
+            AND block_no > :block_no
+    )EOS");
+
+    sqlite3pp::command st_rt_rpl(db, R"EOS(
+        REPLACE INTO remote_tracking
+            SELECT
+                t.key, b.entry_id, b.block_no, NULL
+            FROM
+                remote_trackers AS t,
+                blocks_digests AS b
+            WHERE
+                b.entry_id = :entry_id
+                AND b.block_no BETWEEN :first_block_no AND :last_block_no
+    )EOS");
+
+    // multi row upsert of changed blocks, statements for every row count
+    // are prepared on first use, seven parameters per row fit in default
+    // limit of 999 host parameters
+    constexpr const size_t blk_rpl_rows = 128;
+    std::unique_ptr<sqlite3pp::command> st_blk_rpl[blk_rpl_rows + 1];
+
+    auto blk_rpl = [&] (size_t rows) -> sqlite3pp::command & {
+        auto & st = st_blk_rpl[rows];
+
+        if( !st ) {
+            std::string sql =
+                "REPLACE INTO blocks_digests ("
+                " entry_id, block_no, mtime, digest, block_offset, block_length, hole"
+                ") VALUES ";
+
+            // numbered, sqlite3pp does not accept anonymous parameters
+            for( size_t i = 0, idx = 1; i < rows; i++ ) {
+                sql += i == 0 ? "(" : ", (";
+
+                for( size_t j = 0; j < 7; j++, idx++ )
+                    sql += (j == 0 ? "?" : ", ?") + std::to_string(idx);
+
+                sql += ")";
+            }
+
+            st.reset(new sqlite3pp::command(db, sql.c_str()));
+        }
+
+        return *st;
+    };
+
+    struct parent_dir {
+        uint64_t id;
+        uint64_t mtim;
+        uint64_t mtime;
+    };
+
+    path_trie<parent_dir> parents;
+    parent_dir root = { 0, 0, 0 };
+
+    // index does not depend on cache, it is left out if broken
+    std::unique_ptr<hash_cache> cache;
+
+    if( !hash_cache_path_.empty() )
+        try {
+            cache = std::make_unique<hash_cache>(hash_cache_path_);
+        }
+        catch( const std::exception & e ) {
+            std::cerr << e << std::endl;
+        }
+
+    // digests of files unchanged since cache was enabled are copied to it
+    // from index until one complete pass
+    const bool seed_cache = cache != nullptr && !cache->seeded();
+
+    sqlite3pp::command st_rpl_checkpoint(db, R"EOS(
+        REPLACE INTO checkpoints (root_path, generation, path) VALUES (:root_path, :generation, :path)
     )EOS");
 
-    sqlite3pp::command st_blk_ins(db, R"EOS(
-        INSERT INTO blocks_digests (
-            entry_id, block_no, mtime, digest
-        ) VALUES (
-            :entry_id, :block_no, :mtime, :digest)
-	)EOS");
+    // full pass position is saved on commit, directory is passed when its
+    // listing is merged and files queued for hashing up to it are stored,
+    // they are stored out of order
+    const bool checkpoints = p_paths == nullptr && resumable_;
+    std::deque<std::pair<uint64_t, std::string>> passed;    // jobs pushed before, directory
+    std::set<uint64_t> unstored;                            // numbers of pushed jobs
+    std::unordered_map<uint64_t, uint64_t> unstored_ids;    // entry id -> job number
+    uint64_t pushed = 0;
+
+    auto save_checkpoint = [&] {
+        auto first = unstored.empty() ? pushed : *unstored.begin();
+        std::string path;
+
+        while( !passed.empty() && passed.front().first <= first ) {
+            path = std::move(passed.front().second);
+            passed.pop_front();
+        }
+
+        if( path.empty() )
+            return;
+
+        st_rpl_checkpoint.bind("root_path", root_path, sqlite3pp::nocopy);
+        st_rpl_checkpoint.bind("generation", generation);
+        st_rpl_checkpoint.bind("path", path, sqlite3pp::nocopy);
+        st_rpl_checkpoint.execute();
+    };
+
+    sqlite3pp::transaction tx(&db);
+
+    auto tx_start = clock_gettime_ns();
+
+    auto tx_deadline = [&] {
+        auto now = clock_gettime_ns();
+        auto deadline = tx_start + std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::milliseconds(50)).count();
+
+        if( now >= deadline ) {
+            save_checkpoint();
+            tx.commit();
+            tx.start();
+
+            if( cache != nullptr )
+                cache->commit();
+
+            tx_start = now;
+        }
+    };
+
+    struct stored_entry {
+        uint64_t id = 0;        // zero if not stored
+        uint64_t mtim = 0;
+        uint64_t block_size = 0;
+        uint64_t ino = 0;
+        std::string name;
+        // filled by merge only
+        bool is_dir = false;
+        uint64_t file_size = 0;
+        std::key512 digest;
+    };
+
+    auto find_entry = [&] (uint64_t parent_id, const std::string & name) {
+        stored_entry entry;
+
+        st_sel.bind("parent_id", parent_id);
+        st_sel.bind("name", name, sqlite3pp::nocopy);
+
+        at_scope_exit( st_sel.reset() );
+
+        auto i = st_sel.begin();
+
+        if( i ) {
+            entry.id = i->get<uint64_t>("id");
+            entry.mtim = i->get<uint64_t>("mtime");
+            entry.block_size = i->get<uint64_t>("block_size");
+            entry.ino = i->get<uint64_t>("ino");
+        }
+
+        return entry;
+    };
+
+    // digest of directory is one of names, kinds and digests of its childs,
+    // directory with changed childs is marked stale by null digest, so mark
+    // survives interrupted pass, and recomputed at the end of pass, old
+    // digest stops recomputation of ancestors if did not change
+    std::unordered_map<uint64_t, std::pair<bool, std::key512>> stale_dirs;
+
+    auto stale = [&] (uint64_t dir_id) {
+        if( dir_id == 0 || dir_id == root.id || stale_dirs.find(dir_id) != stale_dirs.end() )
+            return;
+
+        auto & old = stale_dirs[dir_id];
+
+        st_sel_digest.bind("id", dir_id);
+
+        {
+            at_scope_exit( st_sel_digest.reset() );
+
+            auto i = st_sel_digest.begin();
+
+            if( !i )
+                return;
+
+            old.first = true;
+            old.second = i->get<std::key512>("digest");
+        }
+
+        st_upd_dir.bind("digest", nullptr);
+        st_upd_dir.bind("id", dir_id);
+        st_upd_dir.execute();
+    };
+
+	auto update_entry = [&] (
+        const parent_dir & parent,
+		const std::string & name,
+        const stored_entry & stored,
+		bool is_dir,
+        uint64_t mtime,
+        uint64_t file_size,
+        uint64_t block_size,
+        uint64_t dev,
+        uint64_t ino,
+        uint64_t * p_mtim = nullptr)
+	{
+		auto bind = [&] (auto & st) {
+            st.bind("parent_id", parent.id);
+            st.bind("name", name, sqlite3pp::nocopy);
+
+			if( is_dir )
+                st.bind("is_dir", is_dir);
+			else
+                st.bind("is_dir", nullptr);
+
+            if( file_size == 0 )
+                st.bind("file_size", nullptr);
+            else
+                st.bind("file_size", file_size);
+
+            if( block_size == 0 )
+                st.bind("block_size", nullptr);
+            else
+                st.bind("block_size", block_size);
+
+            if( ino == 0 ) {
+                st.bind("dev", nullptr);
+                st.bind("ino", nullptr);
+            }
+            else {
+                st.bind("dev", dev);
+                st.bind("ino", ino);
+            }
+        };
+		
+        uint64_t id = stored.id, mtim = stored.mtim, blk_size = stored.block_size;
+
+        // block size policy changed for file, its blocks must be rebuilt
+        bool resize = id != 0 && !is_dir && blk_size != block_size;
+
+        // replaced by other file within the same mtime tick, e.g. renamed
+        // over or copied with its mtime
+        bool replaced = id != 0 && stored.ino != 0 && ino != 0 && ino != stored.ino;
+
+        // then mtime not changed entry is left untouched, deleted ones are
+        // found by merge of directory listing with stored childs
+        if( !modified_only_ || id == 0 || (mtim != mtime && mtime != 0) || resize || replaced ) {
+            stale(parent.id);
+
+            if( id == 0 ) {
+                auto next_id = entries_ids.next();
+                st_ins.bind("id", next_id);
+                bind(st_ins);
+                st_ins.execute();
+                //if( st_ins.execute(SQLITE_CONSTRAINT_UNIQUE) != SQLITE_CONSTRAINT_UNIQUE )
+                id = next_id;
+            }
+            else {
+                if( is_dir )
+                    stale(id);
+
+                // file replaced by directory leaves no blocks, their removal
+                // is flagged for remote trackers by trigger
+                if( is_dir && !stored.is_dir ) {
+                    st_blk_del.bind("entry_id", id);
+                    st_blk_del.bind("block_no", uint64_t(0));
+                    st_blk_del.execute();
+                }
+
+                bind(st_upd);
+                st_upd.execute();
+            }
+        }
+        else if( ino != 0 && ino != stored.ino ) {
+            // indexed before inodes were stored
+            st_upd_ino.bind("id", id);
+            st_upd_ino.bind("dev", dev);
+            st_upd_ino.bind("ino", ino);
+            st_upd_ino.execute();
+        }
+
+        if( p_mtim != nullptr )
+            *p_mtim = resize || replaced ? 0 : mtim;
+
+        tx_deadline();
+
+        return id;
+    };
+
+    directory_reader dr;
+    bool update_snap = false;
+
+    struct key512_hash {
+        size_t operator () (const std::key512 & k) const {
+            return size_t(k.hash());
+        }
+    };
+
+    std::vector<file_block> prev_blocks;
+    std::unordered_set<std::key512, key512_hash> prev_digests_set;
+    std::vector<size_t> dirty_blocks;
+    std::vector<std::pair<uint64_t, uint64_t>> changed_ranges;
+
+    // rows of blocks differing from stored ones are written in batches,
+    // whole fixed size blocks of zeros are marked, so peer makes hole of
+    // them, fixed size alone keeps zero digests cache small
+    auto store_dirty_blocks = [&] (const file_hash_job & job) {
+        auto zero_digest = job.chunk_avg == 0 && !dirty_blocks.empty()
+            ? zero_block_digest(job.block_size) : std::key512(std::zero_initialized);
+
+        for( size_t i = 0; i < dirty_blocks.size(); ) {
+            auto rows = std::min(blk_rpl_rows, dirty_blocks.size() - i);
+            auto & st = blk_rpl(rows);
+            int idx = 1;
+
+            for( size_t j = 0; j < rows; j++ ) {
+                auto n = dirty_blocks[i + j];
+                const auto & block = job.blocks[n];
+
+                st.bind(idx++, uint64_t(job.entry_id));
+                st.bind(idx++, uint64_t(n + 1));
+                st.bind(idx++, uint64_t(job.mtime));
+                st.bind(idx++, block.digest.data(), sizeof(block.digest), sqlite3pp::nocopy);
+                st.bind(idx++, block.offset);
+                st.bind(idx++, block.length);
+
+                if( job.chunk_avg == 0 && block.length == job.block_size && block.digest == zero_digest )
+                    st.bind(idx++, uint64_t(1));
+                else
+                    st.bind(idx++, nullptr);
+            }
+
+            st.execute();
+            i += rows;
+        }
+    };
+
+    file_hasher::completion store_blocks = [&] (file_hash_job & job) {
+        if( job.error == 0 ) {
+            prev_blocks.clear();
+            prev_digests_set.clear();
+            dirty_blocks.clear();
+            changed_ranges.clear();
+
+            st_blk_sel.bind("entry_id", job.entry_id);
+
+            {
+                at_scope_exit( st_blk_sel.reset() );
+
+                for( auto i = st_blk_sel.begin(); i; i++ ) {
+                    auto blk_no = i->get<uint64_t>("block_no");
+
+                    // missing rows are taken as empty blocks which never match
+                    if( prev_blocks.size() < blk_no )
+                        prev_blocks.resize(size_t(blk_no), file_block { 0, 0, std::key512(std::zero_initialized) });
+
+                    auto & prev = prev_blocks[size_t(blk_no - 1)];
+                    prev.digest = i->get<std::key512>("digest");
+                    prev.offset = i->get<uint64_t>("block_offset");
+                    prev.length = i->get<uint64_t>("block_length");
+
+                    if( job.chunk_avg != 0 )
+                        prev_digests_set.emplace(prev.digest);
+                }
+            }
+
+            for( size_t n = 0; n < job.blocks.size(); n++ ) {
+                const auto & block = job.blocks[n];
+                bool stored = n < prev_blocks.size()
+                    && prev_blocks[n].digest == block.digest
+                    && prev_blocks[n].offset == block.offset
+                    && prev_blocks[n].length == block.length;
+
+                if( stored )
+                    continue;
+
+                dirty_blocks.push_back(n);
+
+                // content defined chunks shift on insertion or deletion, one
+                // only moved is rewritten with its new position, but not
+                // flagged for resync, peer has its content already, so chunk
+                // is changed only if its content was not in file before
+                bool changed = job.chunk_avg != 0
+                    ? prev_digests_set.find(block.digest) == prev_digests_set.end()
+                    : n >= prev_blocks.size() || prev_blocks[n].digest != block.digest;
+
+                if( !changed )
+                    continue;
+
+                if( !changed_ranges.empty() && changed_ranges.back().second == n )
+                    changed_ranges.back().second = n + 1;
+                else
+                    changed_ranges.emplace_back(n + 1, n + 1);
+            }
+
+            store_dirty_blocks(job);
+
+            for( const auto & range : changed_ranges ) {
+                st_rt_rpl.bind("entry_id", job.entry_id);
+                st_rt_rpl.bind("first_block_no", range.first);
+                st_rt_rpl.bind("last_block_no", range.second);
+                st_rt_rpl.execute();
+            }
+
+            // remote tracking of removed blocks is maintained by the trigger
+            st_blk_del.bind("entry_id", job.entry_id);
+            st_blk_del.bind("block_no", uint64_t(job.blocks.size()));
+            st_blk_del.execute();
+
+            st_upd_after.bind("digest", job.digest, sqlite3pp::nocopy);
+            st_upd_after.bind("mtime", job.mtime);
+            update_snap = true;
+        }
+        else {
+            // file vanished or unreadable, leave mtime empty to retry on next pass
+            st_upd_after.bind("digest", nullptr);
+            st_upd_after.bind("mtime", nullptr);
+        }
+
+        st_upd_after.bind("id", job.entry_id);
+        st_upd_after.execute();
+
+        tx_deadline();
+    };
+
+    // hardlinks and bind mounts of the same file, or file met twice in one
+    // pass, are hashed once, other paths reuse digests of the first one
+    struct inode_key {
+        uint64_t dev;
+        uint64_t ino;
+
+        bool operator == (const inode_key & k) const {
+            return dev == k.dev && ino == k.ino;
+        }
+    };
+
+    struct inode_key_hash {
+        size_t operator () (const inode_key & k) const {
+            return size_t(std::rhash(k.ino) ^ k.dev);
+        }
+    };
+
+    struct inode_source {
+        uint64_t fsize;
+        uint64_t mtime;
+        uint64_t ctime;
+        uint64_t entry_id;
+        bool hashing;                   // job of source is in flight
+        std::vector<uint64_t> aliases;  // entries waiting for its digests
+    };
+
+    // no new sources above the limit
+    constexpr const size_t max_inodes = 1024 * 1024;
+    std::unordered_map<inode_key, inode_source, inode_key_hash> inodes;
+    std::unordered_map<uint64_t, inode_key> hashing_inodes;
+
+    // digests of file stored in this or previous pass as if it was read
+    auto load_block_digests = [&] (uint64_t entry_id, file_hash_job & job) {
+        st_blk_sel.bind("entry_id", entry_id);
+        at_scope_exit( st_blk_sel.reset() );
+
+        job.blocks.clear();
+
+        for( auto i = st_blk_sel.begin(); i; i++ )
+            job.blocks.push_back(file_block {
+                i->get<uint64_t>("block_offset"),
+                i->get<uint64_t>("block_length"),
+                i->get<std::key512>("digest")
+            });
+    };
+
+    auto load_blocks = [&] (uint64_t entry_id, file_hash_job & job) {
+        st_sel_digest.bind("id", entry_id);
+
+        {
+            at_scope_exit( st_sel_digest.reset() );
+            auto i = st_sel_digest.begin();
+
+            if( !i )
+                return false;
+
+            job.digest = i->get<std::key512>("digest");
+        }
+
+        load_block_digests(entry_id, job);
+        job.error = 0;
+
+        return true;
+    };
+
+    // entries missing from complete listings of their directories, deleted
+    // at the end of pass unless met at new place
+    std::unordered_set<uint64_t> vanished;
+    std::unordered_set<uint64_t> moved;
+    bool detect_moves = false;
+
+    struct vanished_file {
+        uint64_t id;
+        uint64_t file_size;
+        uint64_t block_size;
+    };
+
+    std::unordered_map<std::key512, vanished_file, key512_hash> vanished_digests;
+
+    auto vanish = [&] (uint64_t parent_id, const stored_entry & entry) {
+        if( moved.find(entry.id) != moved.end() )
+            return;
+
+        vanished.insert(entry.id);
+        stale(parent_id);
+
+        if( !entry.is_dir && entry.mtim != 0 )
+            vanished_digests.emplace(entry.digest, vanished_file { entry.id, entry.file_size, entry.block_size });
+    };
+
+    auto move_entry = [&] (uint64_t id, uint64_t parent_id, const std::string & name) {
+        st_sel_dir.bind("id", id);
+
+        {
+            at_scope_exit( st_sel_dir.reset() );
+
+            auto i = st_sel_dir.begin();
+
+            if( i )
+                stale(i->get<uint64_t>("parent_id"));
+        }
+
+        stale(parent_id);
+
+        st_move.bind("id", id);
+        st_move.bind("parent_id", parent_id);
+        st_move.bind("name", name, sqlite3pp::nocopy);
+        st_move.execute();
+
+        vanished.erase(id);
+        moved.insert(id);
+    };
+
+    // files new in this pass, matched with vanished ones by digest then
+    // inode did not survive move, e.g. copied from other file system
+    struct inserted_file {
+        uint64_t parent_id;
+        std::string name;
+        uint64_t dev;
+        uint64_t ino;
+    };
+
+    std::unordered_map<uint64_t, inserted_file> inserted;
+
+    auto move_by_digest = [&] (const file_hash_job & job) -> uint64_t {
+        auto n = inserted.find(job.entry_id);
+
+        if( n == inserted.end() )
+            return 0;
+
+        auto file = std::move(n->second);
+        inserted.erase(n);
+
+        if( job.error != 0 )
+            return 0;
+
+        auto v = vanished_digests.find(job.digest);
+
+        if( v == vanished_digests.end() )
+            return 0;
+
+        auto stored = v->second;
+        vanished_digests.erase(v);
+
+        if( stored.file_size != job.file_size || stored.block_size != job.block_size
+            || vanished.find(stored.id) == vanished.end() )
+            return 0;
+
+        // new row has no blocks yet, stored one keeps its blocks and id
+        st_del_subtree.bind("id", job.entry_id);
+        st_del_subtree.execute();
+
+        move_entry(stored.id, file.parent_id, file.name);
+
+        st_upd_after.bind("digest", job.digest, sqlite3pp::nocopy);
+        st_upd_after.bind("mtime", job.mtime);
+        st_upd_after.bind("id", stored.id);
+        st_upd_after.execute();
+
+        if( file.ino != 0 ) {
+            st_upd_ino.bind("id", stored.id);
+            st_upd_ino.bind("dev", file.dev);
+            st_upd_ino.bind("ino", file.ino);
+            st_upd_ino.execute();
+        }
+
+        update_snap = true;
+
+        return stored.id;
+    };
+
+    // identities of files being hashed to be cached
+    std::unordered_map<uint64_t, hash_cache::file_identity> cache_identities;
+
+    file_hasher::completion store_hashed = [&] (file_hash_job & job) {
+        auto u = unstored_ids.find(job.entry_id);
+
+        if( u != unstored_ids.end() ) {
+            unstored.erase(u->second);
+            unstored_ids.erase(u);
+        }
+
+        auto c = cache_identities.find(job.entry_id);
+
+        if( c != cache_identities.end() ) {
+            if( job.error == 0 )
+                cache->store(job, c->second);
+
+            cache_identities.erase(c);
+        }
+
+        auto moved_id = move_by_digest(job);
+
+        if( moved_id == 0 )
+            store_blocks(job);
+
+        auto h = hashing_inodes.find(job.entry_id);
+
+        if( h == hashing_inodes.end() )
+            return;
+
+        auto i = inodes.find(h->second);
+        hashing_inodes.erase(h);
+
+        if( moved_id != 0 )
+            i->second.entry_id = moved_id;
+
+        auto aliases = std::move(i->second.aliases);
+
+        // unreadable source, aliases are retried on next pass as well
+        if( job.error != 0 )
+            inodes.erase(i);
+        else
+            i->second.hashing = false;
+
+        auto entry_id = job.entry_id;
+
+        for( auto alias : aliases ) {
+            job.entry_id = alias;
+            store_blocks(job);
+        }
+
+        job.entry_id = entry_id;
+    };
+
+    // enumeration, hashing and this thread as database writer run as
+    // a pipeline, each stage bounded by its pending limit
+    file_hash_pipeline hashing(hash_threads_, async_io_, hash_pending_, hash_pending_size_, p_shutdown, throttle_);
+
+    dr.recursive_ = dr.list_directories_ = true;
+    dr.threads_ = traversal_threads_;
+    dr.max_pending_ = traversal_pending_;
+    dr.throttle_ = throttle_;
+
+#if !_WIN32
+    struct stat root_st;
 
-	sqlite3pp::command st_blk_upd(db, R"EOS(
-		UPDATE blocks_digests SET
-            digest = :digest,
-            mtime = :mtime
-		WHERE
-            entry_id = :entry_id
-            AND block_no = :block_no
-	)EOS");
+    if( throttle_ != nullptr && ::stat(dir_path_name.c_str(), &root_st) == 0 )
+        throttle_->device(root_st.st_dev);
+#endif
 
-    sqlite3pp::command st_blk_del(db, R"EOS(
-        DELETE FROM blocks_digests
-        WHERE
-            entry_id = :entry_id
-            AND block_no > :block_no
-    )EOS");
+    // stored childs of directory being listed, entries of directory are
+    // delivered together and both are sorted by name, so single merge pass
+    // classifies them as new, stored or deleted
+    struct {
+        bool loaded = false;
+        uint64_t parent_id = 0;
+        std::string path;
+        std::vector<stored_entry> entries;
+        size_t next = 0;
+    } childs;
 
-    sqlite3pp::command st_rt_rpl(db, R"EOS(
-        REPLACE INTO remote_tracking
-            SELECT
-                key, :entry_id, :block_no, NULL
-            FROM
-                remote_trackers
-    )EOS");
+    // stored childs not met in complete listing are vanished
+    auto finish_childs = [&] {
+        if( !childs.loaded )
+            return;
 
-    sqlite3pp::command st_rt_del(db, R"EOS(
-        REPLACE INTO remote_tracking
-            SELECT
-                key, :entry_id, :block_no, 1
-            FROM
-                remote_trackers
-    )EOS");
+        for( ; childs.next < childs.entries.size(); childs.next++ )
+            vanish(childs.parent_id, childs.entries[childs.next]);
 
-    struct parent_dir {
-        uint64_t id;
-        uint64_t mtim;
-        uint64_t mtime;
+        childs.loaded = false;
+        childs.entries.clear();
+
+        if( checkpoints )
+            passed.emplace_back(pushed, std::move(childs.path));
+
+        tx_deadline();
     };
 
-    std::unordered_map<std::string, parent_dir> parents;
-    sqlite3pp::transaction tx(&db);
+    auto load_childs = [&] (uint64_t parent_id, const std::string & path) {
+        if( childs.loaded && childs.parent_id == parent_id )
+            return;
 
-    auto tx_start = clock_gettime_ns();
+        finish_childs();
 
-    auto tx_deadline = [&] {
-        auto now = clock_gettime_ns();
-        auto deadline = tx_start + std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::milliseconds(50)).count();
+        childs.path = path;
 
-        if( now >= deadline ) {
-            tx.commit();
-            tx.start();
-            tx_start = now;
+        st_sel_childs.bind("parent_id", parent_id);
+
+        at_scope_exit( st_sel_childs.reset() );
+
+        for( auto i = st_sel_childs.begin(); i; i++ ) {
+            childs.entries.emplace_back();
+            auto & entry = childs.entries.back();
+            entry.id = i->get<uint64_t>("id");
+            entry.mtim = i->get<uint64_t>("mtime");
+            entry.block_size = i->get<uint64_t>("block_size");
+            entry.ino = i->get<uint64_t>("ino");
+            entry.name = i->get<const char *>("name");
+            entry.is_dir = i->get<uint64_t>("is_dir") != 0;
+            entry.file_size = i->get<uint64_t>("file_size");
+
+            if( entry.mtim != 0 && !entry.is_dir )
+                entry.digest = i->get<std::key512>("digest");
         }
-    };
 
-    auto update_block_digest = [&] (
-        uint64_t entry_id,
-        uint64_t blk_no,
-        uint64_t mtim,
-        const std::key512 & block_digest,
-        const std::key512 & prev_block_digest)
-    {
-        auto bind = [&] (auto & st) {
-            st.bind("entry_id", entry_id);
-            st.bind("block_no", blk_no);
-            st.bind("mtime"   , mtim);
-            st.bind("digest"  , block_digest, sqlite3pp::nocopy);
-        };
+        childs.loaded = true;
+        childs.parent_id = parent_id;
+        childs.next = 0;
+    };
 
-        bind(st_blk_ins);
+    auto merge_child = [&] (uint64_t parent_id, const std::string & path, const std::string & name) {
+        load_childs(parent_id, path);
 
-        db.exceptions(false);
-        st_blk_ins.execute();
-        db.exceptions(true);
+        auto & entries = childs.entries;
 
-        if( st_blk_ins.rc() == SQLITE_CONSTRAINT_UNIQUE ) {
-            bind(st_blk_upd);
-            st_blk_upd.execute();
-        }
+        while( childs.next < entries.size() && entries[childs.next].name < name )
+            vanish(parent_id, entries[childs.next++]);
 
-        if( block_digest != prev_block_digest ) {
-            st_rt_rpl.bind("entry_id", entry_id);
-            st_rt_rpl.bind("block_no", blk_no);
-            st_rt_rpl.execute();
-        }
+        if( childs.next < entries.size() && entries[childs.next].name == name )
+            return std::move(entries[childs.next++]);
 
-        tx_deadline();
+        return stored_entry();
     };
 
-	auto update_entry = [&] (
-        const parent_dir & parent,
-		const std::string & name,
-		bool is_dir,
-        uint64_t mtime,
-        uint64_t file_size,
-        uint64_t block_size,
-        uint64_t * p_mtim = nullptr)
-	{
-		auto bind = [&] (auto & st) {
-            st.bind("parent_id", parent.id);
-            st.bind("name", name, sqlite3pp::nocopy);
+    // directory renamed within its parent to name before the old one in
+    // listing is met first, old name is not vanished yet, so it is stored
+    // as new one and the move is made when listing of parent is complete
+    struct deferred_move {
+        uint64_t entry_id;
+        stored_entry moved;
+        std::string name;
+        std::string path_name;
+        uint64_t mtime;
+    };
 
-			if( is_dir )
-                st.bind("is_dir", is_dir);
-			else
-                st.bind("is_dir", nullptr);
+    std::vector<deferred_move> deferred_moves;
 
-            if( file_size == 0 )
-                st.bind("file_size", nullptr);
-            else
-                st.bind("file_size", file_size);
+    // new entry may be a stored one moved from other place, matched by inode,
+    // type and mtime, and for files by size, while its old path is vanished
+    // in this pass, otherwise it is taken for other link of the same file,
+    // directory moved before its old path is met is stored as new one
+    // stored entries of inode of entry, with its parent id
+    auto inode_candidates = [&] (const directory_entry & e, uint64_t fmtim) {
+        std::vector<std::pair<stored_entry, uint64_t>> candidates;
 
-            if( block_size == 0 )
-                st.bind("block_size", nullptr);
-            else
-                st.bind("block_size", block_size);
-        };
-		
-        st_sel.bind("parent_id", parent.id);
-        st_sel.bind("name", name, sqlite3pp::nocopy);
+        st_sel_ino.bind("ino", e.ino);
 
-        uint64_t id = 0, mtim = 0;
+        {
+            at_scope_exit( st_sel_ino.reset() );
 
-        auto get_id_mtim = [&] {
-            at_scope_exit( st_sel.reset() );
+            for( auto i = st_sel_ino.begin(); i; i++ ) {
+                if( i->get<uint64_t>("dev") != e.dev || (i->get<uint64_t>("is_dir") != 0) != e.is_dir )
+                    continue;
 
-            auto i = st_sel.begin();
+                if( i->get<uint64_t>("mtime") != fmtim || (!e.is_dir && i->get<uint64_t>("file_size") != e.fsize) )
+                    continue;
 
-            if( i ) {
-                id = i->get<uint64_t>("id");
-                mtim = i->get<uint64_t>("mtime");
+                candidates.emplace_back();
+                auto & c = candidates.back().first;
+                c.id = i->get<uint64_t>("id");
+                c.mtim = i->get<uint64_t>("mtime");
+                c.block_size = i->get<uint64_t>("block_size");
+                c.ino = e.ino;
+                candidates.back().second = i->get<uint64_t>("parent_id");
             }
-        };
+        }
 
-        get_id_mtim();
+        return candidates;
+    };
+
+    // digests of stored entry of the same file serve new path of it too,
+    // if its old path is vanished later they are copied before its rows
+    // are deleted
+    auto inode_alias = [&] (const directory_entry & e, uint64_t fmtim, uint64_t source_id) {
+        if( inodes.size() < max_inodes )
+            inodes.emplace(inode_key { e.dev, e.ino }, inode_source {
+                e.fsize, fmtim, 1000000000ull * e.ctime + e.ctime_ns, source_id, false, {} });
+    };
+
+    auto find_moved = [&] (const parent_dir & parent, const directory_entry & e, uint64_t fmtim, stored_entry * p_deferred) {
+        if( !detect_moves || e.ino == 0 )
+            return stored_entry();
 
-        // then mtime not changed, just touch entry
-        if( modified_only_ && id != 0 && (mtim == mtime || mtime == 0) ) {
-            // touch only if parent dir changed and not root
-            if( parent.mtim != parent.mtime && parent.id != 0 ) {
-                st_upd_touch.bind("id", id);
-                st_upd_touch.execute();
+        auto candidates = inode_candidates(e, fmtim);
+
+        for( auto & c : candidates ) {
+            if( vanished.find(c.first.id) != vanished.end() ) {
+                move_entry(c.first.id, parent.id, e.name);
+                return c.first;
             }
         }
-        else {
-            if( id == 0 ) {
-                auto next_id = row_next_id();
-                st_ins.bind("id", next_id);
-                bind(st_ins);
-                st_ins.execute();
-                //if( st_ins.execute(SQLITE_CONSTRAINT_UNIQUE) != SQLITE_CONSTRAINT_UNIQUE )
-                id = next_id;
+
+        for( auto & c : candidates ) {
+            if( moved.find(c.first.id) != moved.end() )
+                continue;
+
+            if( e.is_dir && c.second == parent.id ) {
+                *p_deferred = c.first;
+                break;
             }
-            else {
-                bind(st_upd);
-                st_upd.execute();
+
+            if( e.is_reg ) {
+                inode_alias(e, fmtim, c.first.id);
+                break;
             }
         }
 
-        if( p_mtim != nullptr )
-            *p_mtim = mtim;
+        return stored_entry();
+    };
 
-        if( id == 0 )
-            get_id_mtim();
+    // resumed pass does not deliver entries of directories passed, so ones
+    // listed after them are found, or inserted if new, down from the
+    // nearest known ancestor
+    auto resume_parent = [&] (const std::string & path) -> const parent_dir & {
+        std::vector<size_t> ends;
+        auto pos = path.size();
 
-        tx_deadline();
+        while( parents.find(path, pos) == nullptr ) {
+            ends.push_back(pos);
+            pos = pos == 0 ? std::string::npos : path.rfind(path_delimiter[0], pos - 1);
 
-        return id;
+            if( pos == std::string::npos )
+                throw std::xruntime_error("Undefined behavior", __FILE__, __LINE__);
+        }
+
+        for( auto end = ends.rbegin(); end != ends.rend(); end++ ) {
+            const auto parent = *parents.find(path, pos);
+            auto name = path.substr(pos + 1, *end - pos - 1);
+            auto entry = find_entry(parent.id, name);
+
+            // mtime of new one is left empty, so it is listed next pass too
+            if( entry.id == 0 ) {
+                file_stat st(path.substr(0, *end));
+                entry.id = update_entry(parent, name, entry, true, st.mtime(), st.fsize(), 0, st.st_dev, st.st_ino);
+            }
+
+            parents.insert(path, parent_dir { entry.id, entry.mtim, entry.mtim }, *end);
+            pos = *end;
+        }
+
+        return *parents.find(path);
     };
 
-    directory_reader dr;
-    bool update_snap = false;
+    // directory of entries at level, root one is stored on first use
+    auto find_parent = [&] (const std::string & path, uintptr_t level) -> const parent_dir & {
+        auto pit = parents.find(path);
+
+        if( pit != nullptr )
+            return *pit;
+
+        if( level > 1 && !dr.resume_.empty() )
+            return resume_parent(path);
+
+        if( level > 1 )
+            throw std::xruntime_error("Undefined behavior", __FILE__, __LINE__);
+
+        file_stat st(path);
+        auto root_entry = find_entry(0, path);
+
+        // nothing to be moved from into new tree
+        detect_moves = root_entry.id != 0;
+
+        root.id = update_entry(root, path, root_entry, true, root.mtime = st.mtime(), st.fsize(), 0, st.st_dev, st.st_ino, &root.mtim);
+        return parents.insert(path, root);
+    };
 
-    auto update_blocks = [&] (
-        cdc512 & file_ctx,
-        const std::string & path_name,
-        uint64_t entry_id,
-        uint64_t mtim,
-        size_t block_size)
-    {
+    dr.manipulator_ = [&] (directory_entry & e) {
         if( p_shutdown != nullptr && *p_shutdown ) {
             dr.abort_ = true;
-            return false;
+            return;
         }
 
-        int in = -1;
+        hashing.drain(store_hashed);
 
-#if _MSC_VER
-        at_scope_exit(
-            if( in != -1 )
-                ::_close(in);
-        );
-#else
-        at_scope_exit(
-            if( in != -1 )
-                ::close(in);
-        );
+        const auto & parent = find_parent(e.path, e.level);
 
-#endif
+        auto stored = merge_child(parent.id, e.path, e.name);
 
-        auto err = errno;
-#if _WIN32
-        err = _wsopen_s(&in, QString::fromStdString(path_name).toStdWString().c_str(), _O_RDONLY, _SH_DENYNO, _S_IREAD | _S_IWRITE);
-#elif __MINGW32__
-        err = _sopen_s(&in, path_name.c_str(), _O_RDONLY, _SH_DENYNO, _S_IREAD | _S_IWRITE);
-#elif __linux__
-        in = ::open(path_name.c_str(), O_RDONLY | O_NOATIME);
-        err = in == -1 ? errno : 0;
-#elif (__GNUG__ > 0 && __GNUC__ < 5)
-        in = ::open(path_name.c_str(), O_RDONLY);
-        err = in == -1 ? errno : 0;
-#endif
-        //std::wifstream in(dr.path_name, std::ios::binary);
-        //in.exceptions(std::ios::failbit | std::ios::badbit);
-        if( err != 0 )
-            //throw std::xruntime_error(
-            //    "Failed open file: " + utf_path_name + ", " + std::to_string(err));
-            return false;
+        // skip inaccessible files or directories, stored ones are kept
+        if( access(e.path_name, R_OK | (e.is_dir ? X_OK : 0)) != 0 ) {
+            e.skip = e.is_dir;
+            return;
+        }
 
-        uint64_t blk_no = 0;
-        std::unique_ptr<uint8_t> buf(new uint8_t [block_size]);
+        auto block_size = e.is_dir ? 0 : this->block_size(e.fsize);
 
-        for(;;) {//while( !in.eof() ) {
-            if( p_shutdown != nullptr && *p_shutdown ) {
-                dr.abort_ = true;
-                break;
-            }
+        uint64_t mtim, fmtim = 1000000000ull * e.mtime + e.mtime_ns;
 
-            blk_no++;
+        stored_entry deferred;
 
-            //in.read(reinterpret_cast<char *>(buf), BLOCK_SIZE);
-            //auto r = in.gcount();
+        if( stored.id == 0 )
+            stored = find_moved(parent, e, fmtim, &deferred);
+        else if( e.is_reg && stored.ino != 0 && e.ino != 0 && e.ino != stored.ino && detect_moves )
+            for( auto & c : inode_candidates(e, fmtim) )
+                if( c.first.id != stored.id ) {
+                    inode_alias(e, fmtim, c.first.id);
+                    break;
+                }
 
-            uint64_t bmtim;
-            cdc512 blk_ctx(std::leave_uninitialized);
-            std::key512 prev_blk_digest(std::leave_uninitialized);
+        uint64_t entry_id = update_entry(
+            parent,
+            e.name,
+            stored,
+            e.is_dir,
+            fmtim,
+            e.fsize,
+            block_size,
+            e.dev,
+            e.ino,
+            &mtim);
 
-            st_blk_sel.bind("entry_id", entry_id);
-            st_blk_sel.bind("block_no", blk_no);
-            auto i = st_blk_sel.begin();
+        if( stored.id == 0 && e.is_reg && detect_moves && !vanished_digests.empty() )
+            inserted.emplace(entry_id, inserted_file { parent.id, e.name, e.dev, e.ino });
 
-            if( i ) {
-                bmtim = i->get<uint64_t>("mtime");
-                prev_blk_digest = i->get<std::key512>("digest");
-            }
+        if( e.is_dir ) {
+            parent_dir entry = { entry_id, mtim, fmtim };
+            parents.insert(e.path_name, entry);
 
-            if( !i || bmtim != mtim ) {
-                auto r =
-#if _MSC_VER
-                _read
-#else
-                ::read
-#endif
-                    (in, buf.get(), uint32_t(block_size));
+            if( deferred.id != 0 )
+                deferred_moves.push_back(deferred_move { entry_id, deferred, e.name, e.path_name, fmtim });
+        }
 
-                if( r == -1 ) {
-                    //err = errno;
-                    //throw std::xruntime_error(
-                    //    "Failed read file: " + utf_path_name + ", " + std::to_string(err));
-                    return false;
-                }
+        bool modified = !modified_only_ || mtim != fmtim;
+        auto inode = inodes.end();
+        inode_key key = { e.dev, e.ino };
+        uint64_t fctim = 1000000000ull * e.ctime + e.ctime_ns;
+        hash_cache::file_identity identity = { e.dev, e.ino, e.fsize, fmtim, fctim };
+
+        if( seed_cache && !modified && e.is_reg && e.ino != 0 ) {
+            file_hash_job job;
+            job.block_size = stored.block_size;
+            job.chunk_min = chunk_min_;
+            job.chunk_avg = chunk_avg_;
+            job.chunk_max = chunk_max_;
+
+            if( load_blocks(entry_id, job) )
+                cache->store(job, identity);
+        }
 
-                if( r == 0 )
-                    break;
+        if( e.is_reg && e.ino != 0 ) {
+            inode = inodes.find(key);
 
-                //if( size_t(r) < block_size )
-                //    std::memset(&buf[r], 0, block_size - r);
+            // inode reused or file changed since source was met
+            if( inode != inodes.end() && (inode->second.fsize != e.fsize
+                    || inode->second.mtime != fmtim || inode->second.ctime != fctim) )
+                inode = inodes.end();
 
-                blk_ctx.init();
-                blk_ctx.update(std::make_range(buf, r));
-                blk_ctx.final();
+            // unchanged file is a source for its other links
+            if( !modified && inode == inodes.end() && e.nlink > 1 && inodes.size() < max_inodes )
+                inodes.emplace(key, inode_source { e.fsize, fmtim, fctim, entry_id, false, {} });
+        }
 
-                update_block_digest(entry_id, blk_no, mtim, blk_ctx, prev_blk_digest);
-                update_snap = true;
+        if( modified && inode != inodes.end() ) {
+            if( inode->second.hashing ) {
+                inode->second.aliases.push_back(entry_id);
+                return;
+            }
 
-                file_ctx.update(std::begin(blk_ctx), std::end(blk_ctx));
+            file_hash_job job;
+            job.entry_id = entry_id;
+            job.mtime = fmtim;
+            job.file_size = e.fsize;
+            job.block_size = block_size;
+            job.chunk_avg = chunk_avg_;
+
+            if( load_blocks(inode->second.entry_id, job) ) {
+                job.entry_id = entry_id;
+                store_blocks(job);
+                return;
             }
-            else if( i )
-                file_ctx.update(std::begin(prev_blk_digest), std::end(prev_blk_digest));
         }
 
-        st_blk_del.bind("entry_id", entry_id);
-        st_blk_del.bind("block_no", blk_no);
-        st_blk_del.execute();
+        if( modified ) {
+            // if file modified then calculate digests
 
-        st_rt_del.bind("entry_id", entry_id);
-        st_rt_del.bind("block_no", blk_no);
-        st_rt_del.execute();
+            if( e.is_reg ) {
+                file_hash_job job;
+                job.path_name = e.path_name;
+                job.entry_id = entry_id;
+                job.mtime = fmtim;
+                job.file_size = e.fsize;
+                job.block_size = block_size;
+                job.chunk_min = chunk_min_;
+                job.chunk_avg = chunk_avg_;
+                job.chunk_max = chunk_max_;
+                job.mmap_threshold = mmap_threshold_;
+                job.tree_threshold = tree_threshold_;
+                job.tree_threads = tree_threads_;
+                job.drop_cache = drop_cache_;
+
+                if( cache != nullptr && e.ino != 0 ) {
+                    if( cache->load(job, identity) ) {
+                        store_blocks(job);
+                        return;
+                    }
+
+                    cache_identities.emplace(entry_id, identity);
+                }
 
-        tx_deadline();
+                // grown file of the same inode is likely appended to, its
+                // stored blocks are checked and kept by hasher, but file is
+                // rehashed whole in one of full_rehash_interval passes
+                if( detect_appends_ && (entry_id + generation) % full_rehash_interval != 0
+                    && stored.id != 0 && stored.mtim != 0 && e.ino != 0 && e.ino == stored.ino
+                    && e.fsize > stored.file_size && block_size == stored.block_size
+                    && chunk_avg_ == 0 && (tree_threshold_ == 0 || e.fsize < tree_threshold_) ) {
+                    load_block_digests(entry_id, job);
+                    job.append = !job.blocks.empty();
+                }
 
-        return true;
-    };
+                if( e.ino != 0 ) {
+                    auto i = inodes.find(key);
+                    inode_source source = { e.fsize, fmtim, fctim, entry_id, true, {} };
 
-    parent_dir root = { 0, 0, 0 };
+                    if( i == inodes.end() && inodes.size() < max_inodes )
+                        i = inodes.emplace(key, std::move(source)).first;
+                    else if( i != inodes.end() && !i->second.hashing )
+                        i->second = std::move(source);
+                    else
+                        i = inodes.end();
 
-    dr.recursive_ = dr.list_directories_ = true;
-    dr.manipulator_ = [&] {
+                    if( i != inodes.end() )
+                        hashing_inodes.emplace(entry_id, key);
+                }
+
+                if( checkpoints ) {
+                    unstored.insert(pushed);
+                    unstored_ids.emplace(entry_id, pushed);
+                }
+
+                pushed++;
+                hashing.push(std::move(job), store_hashed);
+            }
+            else {
+                st_upd_after.bind("digest", nullptr);
+                st_upd_after.bind("id", entry_id);
+                st_upd_after.bind("mtime", fmtim);
+                st_upd_after.execute();
+            }
+        }
+    };
+
+    // listing is complete, so stored childs not met in it are vanished,
+    // empty listing delivers no entries to merge them with
+    dr.listed_ = [&] (const std::string & path, uintptr_t level) {
         if( p_shutdown != nullptr && *p_shutdown ) {
             dr.abort_ = true;
             return;
         }
 
-        // skip inaccessible files or directories
-        if( access(dr.path_name_, R_OK | (dr.is_dir_ ? X_OK : 0)) != 0 ) {
-            dr.skip_ = dr.is_dir_;
+        const auto & parent = find_parent(path, level);
+
+        load_childs(parent.id, path);
+        finish_childs();
+
+        // childs are not delivered yet, so new entry has none
+        for( auto & d : deferred_moves ) {
+            if( vanished.find(d.moved.id) == vanished.end() )
+                continue;
+
+            st_del_subtree.bind("id", d.entry_id);
+            st_del_subtree.execute();
+
+            move_entry(d.moved.id, parent.id, d.name);
+            parents.insert(d.path_name, parent_dir { d.moved.id, d.moved.mtim, d.mtime });
+        }
+
+        deferred_moves.clear();
+    };
+
+    auto read_paths = [&] {
+        auto root_entry = find_entry(0, root_path);
+
+        // never indexed, nothing to be incremental against
+        if( root_entry.id == 0 ) {
+            dr.read(root_path);
             return;
         }
 
-        const auto & parent = [&] {
-            auto pit = parents.find(dr.path_);
+        root = { root_entry.id, root_entry.mtim, root_entry.mtim };
 
-			if( pit == parents.cend() ) {
-                if( dr.level_ > 1 )
-                    throw std::xruntime_error("Undefined behavior", __FILE__, __LINE__);
+        const std::string root_prefix = root_path + path_delimiter;
+        std::string covered; // last directory listed with subdirectories
 
-                file_stat st(dr.path_);
-                root.id = update_entry(root, dr.path_, true, root.mtime = st.mtime(), 0, 0, &root.mtim);
-                parents.emplace(std::make_pair(dr.path_, root));
+        // paths are sorted, so ancestors come before their descendants
+        for( const auto & it : *p_paths ) {
+            if( p_shutdown != nullptr && *p_shutdown )
+                break;
 
-                return parents.find(dr.path_)->second;
-            }
+            std::string path = it.first;
+            bool recursive = it.second;
 
-            return pit->second;
-        }();
+            if( path.size() > 1 && path.back() == path_delimiter[0] )
+                path.pop_back();
 
-        size_t block_size = 4096;
+            if( path != root_path && path.compare(0, root_prefix.size(), root_prefix) != 0 )
+                continue;
 
-        uint64_t mtim, fmtim = 1000000000ull * dr.mtime_ + dr.mtime_ns_;
-        uint64_t entry_id = update_entry(
-            parent,
-            dr.name_,
-            dr.is_dir_,
-            fmtim,
-            dr.fsize_,
-            block_size,
-            &mtim);
+            if( !covered.empty() && (path == covered
+                    || path.compare(0, covered.size() + 1, covered + path_delimiter) == 0) )
+                continue;
 
-        if( dr.is_dir_ ) {
-            parent_dir entry = { entry_id, mtim, fmtim };
-            parents.emplace(std::make_pair(dr.path_name_, entry));
-        }
+            // walk parent chain down from root
+            parent_dir parent = { 0, 0, 0 };
+            std::string name = root_path;
+            stored_entry entry = root_entry;
+            size_t pos = root_path.size();
 
-        if( !modified_only_ || mtim != fmtim ) {
-            // if file modified then calculate digests
+            while( pos < path.size() ) {
+                auto next = path.find(path_delimiter[0], pos + 1);
 
-            if( dr.is_reg_ ) {
-                cdc512 ctx;
+                if( next == std::string::npos )
+                    next = path.size();
 
-                if( update_blocks(ctx, dr.path_name_, entry_id, fmtim, block_size) ) {
-                    ctx.final();
-                    st_upd_after.bind("digest", ctx, sqlite3pp::nocopy);
+                auto child_name = path.substr(pos + 1, next - pos - 1);
+                auto child = find_entry(entry.id, child_name);
+
+                if( child.id == 0 ) {
+                    recursive = true;
+                    break;
                 }
+
+                parent = { entry.id, entry.mtim, entry.mtim };
+                name.swap(child_name);
+                entry = std::move(child);
+                pos = next;
             }
-            else {
+
+            path.resize(pos);
+
+            // vanished directories are swept on listing of their parent
+            if( access(path, R_OK | X_OK) != 0 )
+                continue;
+
+            file_stat st(path);
+
+            if( !S_ISDIR(st.st_mode) )
+                continue;
+
+            uint64_t mtim, dir_mtime = st.mtime();
+            auto id = update_entry(parent, name, entry, true, dir_mtime, st.fsize(), 0, st.st_dev, st.st_ino, &mtim);
+
+            if( id == root_entry.id ) {
+                root.mtime = dir_mtime;
+            }
+            else if( mtim != dir_mtime ) {
                 st_upd_after.bind("digest", nullptr);
+                st_upd_after.bind("id", id);
+                st_upd_after.bind("mtime", dir_mtime);
+                st_upd_after.execute();
             }
 
-            st_upd_after.bind("id", entry_id);
-            st_upd_after.bind("mtime", fmtim);
-            st_upd_after.execute();
+            parents.insert(path, parent_dir { id, 0, dir_mtime });
+
+            dr.recursive_ = recursive;
+            dr.threads_ = recursive ? traversal_threads_ : 0;
+            dr.read(path);
+
+            if( dr.abort_ )
+                break;
+
+            if( recursive )
+                covered = path;
         }
     };
 
-    dr.read(dir_path_name);
+    if( p_paths == nullptr ) {
+        auto root_entry = resume_path.empty() ? stored_entry() : find_entry(0, root_path);
+
+        // root is passed whole or its entries at least
+        if( root_entry.id != 0 ) {
+            root = { root_entry.id, root_entry.mtim, root_entry.mtim };
+            parents.insert(root_path, root);
+            detect_moves = true;
+            dr.resume_ = resume_path;
+        }
+
+        dr.read(root_path);
+    }
+    else {
+        read_paths();
+    }
+
+    hashing.finish(store_hashed);
+
+    if( checkpoints && dr.abort_ )
+        save_checkpoint();
+    else if( checkpoints ) {
+        sqlite3pp::command st(db, "DELETE FROM checkpoints WHERE root_path = :root_path");
+        st.bind("root_path", root_path, sqlite3pp::nocopy);
+        st.execute();
+    }
+
+    // resumed pass lists part of tree only
+    if( seed_cache && p_paths == nullptr && dr.resume_.empty() && !dr.abort_ )
+        cache->seeded(true);
+
+    // not met anywhere, kept for next pass if this one was aborted
+    if( !dr.abort_ )
+        for( auto id : vanished ) {
+            st_del_subtree.bind("id", id);
+            st_del_subtree.execute();
+            update_snap = true;
+        }
+
+    // stale directories are recomputed deepest first, so digests of their
+    // subdirectories are already actual, left stale if pass was aborted
+    if( !dr.abort_ ) {
+        std::set<std::pair<uint64_t, uint64_t>> pending; // depth, id
+
+        {
+            at_scope_exit( st_sel_stale.reset() );
+
+            for( auto i = st_sel_stale.begin(); i; i++ )
+                pending.emplace(i->get<uint64_t>("depth"), i->get<uint64_t>("id"));
+        }
+
+        while( !pending.empty() ) {
+            auto last = std::prev(pending.end());
+            auto depth = last->first, id = last->second;
+            pending.erase(last);
+
+            uint64_t parent_id;
+            bool stored, known;
+            std::key512 old;
+
+            st_sel_dir.bind("id", id);
+
+            {
+                at_scope_exit( st_sel_dir.reset() );
+
+                auto i = st_sel_dir.begin();
+
+                if( !i )
+                    continue;
+
+                parent_id = i->get<uint64_t>("parent_id");
+                stored = known = !i->column_isnull(1);
+
+                if( known )
+                    old = i->get<std::key512>("digest");
+            }
+
+            // digest of root is its snap key
+            if( parent_id == 0 ) {
+                update_snap = update_snap || id == root.id;
+                continue;
+            }
+
+            if( !known ) {
+                auto s = stale_dirs.find(id);
+
+                if( s != stale_dirs.end() && s->second.first ) {
+                    known = true;
+                    old = s->second.second;
+                }
+            }
+
+            cdc512 digest;
+            digest.init();
+
+            st_sel_childs.bind("parent_id", id);
+
+            {
+                at_scope_exit( st_sel_childs.reset() );
+
+                for( auto i = st_sel_childs.begin(); i; i++ ) {
+                    auto name = i->get<const char *>("name");
+                    uint8_t is_dir = i->get<uint64_t>("is_dir") != 0 ? 1 : 0;
+                    auto child = i->get<std::key512>("digest"); // zeros if none
+
+                    digest.update(name, std::strlen(name) + 1);
+                    digest.update(&is_dir, sizeof(is_dir));
+                    digest.update(std::begin(child), std::end(child));
+                }
+            }
+
+            digest.final();
+
+            bool changed = !known || old != digest;
+
+            if( changed || !stored ) {
+                st_upd_dir.bind("digest", digest, sqlite3pp::nocopy);
+                st_upd_dir.bind("id", id);
+                st_upd_dir.execute();
+            }
+
+            if( changed )
+                pending.emplace(depth - 1, parent_id);
+
+            tx_deadline();
+        }
+    }
 
     if( !modified_only_ || root.mtim != root.mtime || update_snap ) {
         cdc512 digest(std::leave_uninitialized);
 
         st_sel.bind("parent_id", root.id);
-        st_sel.bind("name", dr.path_, sqlite3pp::nocopy);
+        st_sel.bind("name", root_path, sqlite3pp::nocopy);
 
         auto i = st_sel.begin();
 
@@ -1012,31 +2673,40 @@ void directory_indexer::reindex(
         a.key = digest;
         digest.update(&a, sizeof(a));
 
-        st_upd_after.bind("digest", digest, sqlite3pp::nocopy);
-        st_upd_after.bind("id", root.id);
-        st_upd_after.bind("mtime", root.mtime);
-        st_upd_after.execute();
+        st_upd_snap.bind("digest", digest, sqlite3pp::nocopy);
+        st_upd_snap.bind("id", root.id);
+        st_upd_snap.bind("mtime", root.mtime);
+        st_upd_snap.execute();
     }
 
-    auto cleanup_entries = [&db] {
-        db.execute_all(R"EOS(
-            DELETE FROM entries WHERE id IN (
-               SELECT
-                   e.id
-               FROM
-                   entries AS e
-                       JOIN entries AS p
-                       ON e.parent_id = p.id
-               WHERE
-                   e.is_alive <> 0
-                   AND p.is_alive == 0
-            );
-            /*DELETE FROM entries WHERE is_alive <> 0;*/
-            UPDATE entries SET is_alive = 1 WHERE is_alive = 0;
-        )EOS");
-    };
+    // entries which stopped being directories in this pass were not listed,
+    // their stored subtrees are found through rows of this generation only
+    sqlite3pp::command st_del_orphans(db, R"EOS(
+        DELETE FROM entries WHERE id IN (
+            WITH RECURSIVE subtree(id) AS (
+                SELECT
+                    e.id
+                FROM
+                    entries AS p
+                        JOIN entries AS e
+                        ON e.parent_id = p.id
+                WHERE
+                    p.generation = :generation
+                    AND p.is_dir IS NULL
+                UNION ALL
+                SELECT
+                    e.id
+                FROM
+                    entries AS e
+                        JOIN subtree AS s
+                        ON e.parent_id = s.id
+            )
+            SELECT id FROM subtree
+        )
+    )EOS");
 
-    cleanup_entries();
+    st_del_orphans.bind("generation", generation);
+    st_del_orphans.execute();
 }
 //------------------------------------------------------------------------------
 } // namespace homeostas
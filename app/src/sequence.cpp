@@ -0,0 +1,107 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+#include "config.h"
+//------------------------------------------------------------------------------
+#include "port.hpp"
+#include "sequence.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+id_sequence::id_sequence(sqlite3pp::database & db, const std::string & name, uint64_t range) :
+    db_(db), name_(name), range_(range == 0 ? 1 : range)
+{
+    db_.execute_all(R"EOS(
+        CREATE TABLE IF NOT EXISTS sequences (
+            name            TEXT PRIMARY KEY,
+            next_id         INTEGER NOT NULL
+        ) WITHOUT ROWID;
+    )EOS");
+
+    st_upd_ = std::make_unique<sqlite3pp::command>(db_, R"EOS(
+        UPDATE sequences SET next_id = next_id + :range WHERE name = :name
+    )EOS");
+
+    st_ins_ = std::make_unique<sqlite3pp::command>(db_, R"EOS(
+        INSERT INTO sequences (name, next_id) VALUES (:name, :next_id)
+    )EOS");
+
+    st_sel_ = std::make_unique<sqlite3pp::query>(db_, R"EOS(
+        SELECT next_id FROM sequences WHERE name = :name
+    )EOS");
+}
+//------------------------------------------------------------------------------
+void id_sequence::reserve()
+{
+    // savepoint nests into transaction of caller or starts its own, update
+    // goes first so concurrent connections serialize on write lock
+    db_.execute("SAVEPOINT id_sequence");
+
+    try {
+        // statements must be reset before savepoint is released
+        [&] {
+            at_scope_exit( st_upd_->reset() );
+            st_upd_->bind("range", range_);
+            st_upd_->bind("name", name_, sqlite3pp::nocopy);
+            st_upd_->execute();
+
+            if( db_.changes() == 0 ) {
+                at_scope_exit( st_ins_->reset() );
+
+                // stay positive in signed sqlite integer and far from overflow
+                while( (next_id_ = entropy_fast() >> 2) == 0 );
+
+                last_id_ = next_id_ + range_;
+                st_ins_->bind("name", name_, sqlite3pp::nocopy);
+                st_ins_->bind("next_id", last_id_);
+                st_ins_->execute();
+            }
+            else {
+                at_scope_exit( st_sel_->reset() );
+                st_sel_->bind("name", name_, sqlite3pp::nocopy);
+                auto i = st_sel_->begin();
+
+                if( !i )
+                    throw std::xruntime_error("Sequence " + name_ + " vanished", __FILE__, __LINE__);
+
+                last_id_ = i->get<uint64_t>(0);
+                next_id_ = last_id_ - range_;
+            }
+        }();
+
+        db_.execute("RELEASE id_sequence");
+    }
+    catch (...) {
+        next_id_ = last_id_ = 0;
+        db_.execute("ROLLBACK TO id_sequence");
+        db_.execute("RELEASE id_sequence");
+        throw;
+    }
+}
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
@@ -0,0 +1,185 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+#include "config.h"
+//------------------------------------------------------------------------------
+#include <cstdio>
+#if __linux__
+#   include <sys/sysmacros.h>
+#endif
+#if HAVE_IOPRIO
+#   include <sys/syscall.h>
+#endif
+//------------------------------------------------------------------------------
+#include "port.hpp"
+#include "throttle.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+uint64_t io_throttle::reserve(uint64_t bytes, uint64_t ops)
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+
+    auto now = clock_gettime_ns();
+    auto elapsed = refilled_ == 0 ? 1e9 : double(now - refilled_);
+    uint64_t wait = 0;
+
+    poll(now);
+
+    auto charge = [&] (double & tokens, uint64_t limit, uint64_t amount) {
+        if( limit == 0 ) {
+            tokens = 0;
+            return;
+        }
+
+        auto rate = limit * scale_;
+        tokens = std::min(tokens + rate * elapsed / 1e9, rate) - double(amount);
+
+        if( tokens < 0 )
+            wait = std::max(wait, uint64_t(-tokens / rate * 1e9));
+    };
+
+    charge(bytes_, bytes_per_second_, bytes);
+    charge(ops_, ops_per_second_, ops);
+    refilled_ = now;
+
+    if( scale_ < 1 && bytes_per_second_ == 0 && ops_per_second_ == 0 && ops != 0 )
+        wait = std::max(wait, uint64_t(latency_ * (1 / scale_ - 1)));
+
+    return wait;
+}
+//------------------------------------------------------------------------------
+void io_throttle::poll(uint64_t now)
+{
+#if __linux__
+    constexpr const uint64_t period = 100000000;
+
+    if( !latency_backoff_ || device_ == 0 || now - sampled_ < period )
+        return;
+
+    sampled_ = now;
+
+    char name[64];
+    std::snprintf(name, sizeof(name), "/sys/dev/block/%u:%u/stat", major(dev_t(device_)), minor(dev_t(device_)));
+
+    // no such file for virtual file systems, they are not backed off
+    FILE * f = std::fopen(name, "r");
+
+    if( f == nullptr )
+        return;
+
+    // reads, merged, sectors, milliseconds, then the same for writes
+    unsigned long long v[8];
+    auto n = std::fscanf(f, "%llu %llu %llu %llu %llu %llu %llu %llu",
+        &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+    std::fclose(f);
+
+    if( n != 8 )
+        return;
+
+    uint64_t ios = v[0] + v[4], ticks = v[3] + v[7];
+
+    if( ios_ != 0 && ios > ios_ && ticks >= ticks_ )
+        adjust(double(ticks - ticks_) * 1e6 / double(ios - ios_));
+    else if( ios_ != 0 )
+        adjust(0);
+
+    ios_ = ios;
+    ticks_ = ticks;
+#else
+    (void) now;
+#endif
+}
+//------------------------------------------------------------------------------
+void io_throttle::adjust(double latency)
+{
+    // device was not used
+    if( latency == 0 ) {
+        scale_ = std::min(scale_ + 1. / 16, 1.);
+        return;
+    }
+
+    latency_ = latency;
+    baseline_ = baseline_ == 0 ? latency : std::min(latency, baseline_ + (latency - baseline_) / 256);
+
+    // below millisecond latency is not worth backing off
+    constexpr const double min_congested = 1e6;
+
+    if( latency > std::max(baseline_ * 4, min_congested) )
+        scale_ = std::max(scale_ / 2, 1. / 64);
+    else
+        scale_ = std::min(scale_ + 1. / 16, 1.);
+}
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+#if HAVE_IOPRIO
+// see linux/ioprio.h, not present in older headers
+constexpr const int ioprio_who_process = 1;
+constexpr const int ioprio_class_shift = 13;
+constexpr const int ioprio_class_idle = 3;
+#endif
+//------------------------------------------------------------------------------
+int idle_io_priority()
+{
+#if HAVE_IOPRIO
+    return ioprio_class_idle << ioprio_class_shift;
+#else
+    return 0;
+#endif
+}
+//------------------------------------------------------------------------------
+int enter_idle_io_priority()
+{
+#if HAVE_IOPRIO
+    // zero is calling thread
+    int prev = int(::syscall(SYS_ioprio_get, ioprio_who_process, 0));
+
+    if( prev == -1 )
+        return -1;
+
+    if( ::syscall(SYS_ioprio_set, ioprio_who_process, 0, idle_io_priority()) != 0 )
+        return -1;
+
+    return prev;
+#else
+    return -1;
+#endif
+}
+//------------------------------------------------------------------------------
+void leave_idle_io_priority(int prev)
+{
+#if HAVE_IOPRIO
+    if( prev != -1 )
+        ::syscall(SYS_ioprio_set, ioprio_who_process, 0, prev);
+#else
+    (void) prev;
+#endif
+}
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
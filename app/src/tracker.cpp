@@ -69,21 +69,104 @@ void directory_tracker::worker()
 
     directory_indexer di;
     di.modified_only(true);
+    di.traversal_threads(std::thread::hardware_concurrency());
+    di.hash_threads(std::thread::hardware_concurrency());
+
+    if( hash_cache_ )
+        di.hash_cache_path(hash_cache_path_name_);
+
+    di.throttle(throttle_);
+    di.drop_cache(drop_cache_);
+
+    // started before first scan, so changes made meanwhile are not lost
+    std::unique_ptr<directory_watcher> watcher;
+
+    if( watch_ && !oneshot_ )
+        watcher = directory_watcher::make(dir_path_name_, [&] (const std::string & path_name, bool recursive) {
+            // own database writes must not trigger reindex
+            if( path_name == db_path_ )
+                return;
+
+            std::unique_lock<std::mutex> lk(mtx_);
+
+            if( path_name.empty() ) {
+                rescan_ = true;
+            }
+            else {
+                auto & r = dirty_[path_name];
+                r = r || recursive;
+            }
+
+            lk.unlock();
+            cv_.notify_one();
+        });
+
+    directory_indexer::dirty_paths dirty;
+    bool full = true;
+    auto scanned = std::chrono::steady_clock::now();
+    unsigned failures = 0;
 
     for(;;) {
+        bool failed = false;
+
         try {
             connect_db();
-            di.reindex(*db_, dir_path_name_, &shutdown_);
+
+            if( full )
+                di.reindex(*db_, dir_path_name_, &shutdown_);
+            else
+                di.reindex(*db_, dir_path_name_, dirty, &shutdown_);
+
+            failures = 0;
         }
         catch( const std::exception & e ) {
             std::cerr << e << std::endl;
             detach_db();
+            failed = true;
+            failures++;
         }
 
+        if( full )
+            scanned = std::chrono::steady_clock::now();
+
+        // notifications may be lost, so tree is still scanned periodically
+        auto period = watcher != nullptr && !watcher->failed()
+            ? std::chrono::seconds(3600) : std::chrono::seconds(60);
+
         std::unique_lock<std::mutex> lk(mtx_);
 
-        if( cv_.wait_for(lk, std::chrono::seconds(60), [&] { return shutdown_ || oneshot_; }) )
-            break;
+        // persistent error must not loop on every notification, so failed
+        // pass is retried by full scan after delay doubled on each failure
+        // up to the periodic interval, changes meanwhile are picked up by it
+        if( failed ) {
+            auto delay = std::min(period,
+                std::chrono::seconds(std::chrono::seconds::rep(5) << std::min(failures - 1, 10u)));
+
+            if( cv_.wait_for(lk, delay, [&] { return shutdown_ || oneshot_; }) )
+                break;
+
+            full = true;
+            rescan_ = false;
+            dirty.clear();
+            dirty_.clear();
+            continue;
+        }
+
+        auto changed = [&] { return shutdown_ || oneshot_ || rescan_ || !dirty_.empty(); };
+
+        if( cv_.wait_until(lk, scanned + period, changed) ) {
+            if( shutdown_ || oneshot_ )
+                break;
+
+            // let burst of changes settle
+            if( cv_.wait_for(lk, std::chrono::seconds(1), [&] { return shutdown_; }) )
+                break;
+        }
+
+        full = rescan_ || std::chrono::steady_clock::now() >= scanned + period;
+        rescan_ = false;
+        dirty.clear();
+        dirty.swap(dirty_);
     }
 }
 //------------------------------------------------------------------------------
@@ -128,9 +211,11 @@ void directory_tracker::make_path_name()
     };
 
     db_path_ = home_path(false) + ".homeostas";
-    db_name_ = make_name(dir_user_defined_name_.empty() ? dir_path_name_ : dir_user_defined_name_)
-        + ".sqlite";
+    auto name = make_name(dir_user_defined_name_.empty() ? dir_path_name_ : dir_user_defined_name_);
+    db_name_ = name + ".sqlite";
     db_path_name_ = db_path_ + path_delimiter + db_name_;
+    // not matching database name, so removing databases leaves it
+    hash_cache_path_name_ = db_path_ + path_delimiter + name + ".digests";
 }
 //------------------------------------------------------------------------------
 void directory_tracker::startup()
@@ -197,11 +282,14 @@ void remote_directory_tracker::server_worker(socket_stream & ss, const std::key5
     sqlite3pp::query st_rt_sel(*db_, R"EOS(
         SELECT
             b.parent_id, b.name, b.mtime, b.file_size, b.block_size,
-            a.entry_id, a.block_no, a.deleted
+            a.entry_id, a.block_no, a.deleted,
+            c.block_offset, c.block_length, c.hole
         FROM
             remote_tracking AS a
                 JOIN entries AS b
                 ON a.entry_id = b.id
+                LEFT JOIN blocks_digests AS c
+                ON a.entry_id = c.entry_id AND a.block_no = c.block_no
         WHERE
             key = :key
         ORDER BY
@@ -291,8 +379,11 @@ void remote_directory_tracker::server_worker(socket_stream & ss, const std::key5
             auto send_entry = [&] {
                 // send terminated block
                 if( current_entry_id != 0 ) {
-                    ssbr.block_no = 0;
-                    ssbr.deleted  = 0;
+                    ssbr.block_no     = 0;
+                    ssbr.block_offset = 0;
+                    ssbr.block_length = 0;
+                    ssbr.hole         = 0;
+                    ssbr.deleted      = 0;
                     ss >> ssbr;
 
                     if( ssbr.commit ) {
@@ -339,9 +430,12 @@ void remote_directory_tracker::server_worker(socket_stream & ss, const std::key5
                     send_entry();
 
                 // send changed blocks
-                ssbr.block_no = e->get<uint64_t>("block_no");
-                ssbr.deleted  = e->get<uint8_t>("deleted");
-                ssbr.commit   = 0;
+                ssbr.block_no     = e->get<uint64_t>("block_no");
+                ssbr.block_offset = e->get<uint64_t>("block_offset");
+                ssbr.block_length = e->get<uint64_t>("block_length");
+                ssbr.hole         = e->get<uint8_t>("hole");
+                ssbr.deleted      = e->get<uint8_t>("deleted");
+                ssbr.commit       = 0;
                 ss >> ssbr;
 
                 e++;
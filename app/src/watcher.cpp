@@ -0,0 +1,515 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+#include "config.h"
+//------------------------------------------------------------------------------
+#include <cstring>
+#include <climits>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#if HAVE_INOTIFY || HAVE_FANOTIFY
+#   include <fcntl.h>
+#   include <poll.h>
+#   include <dirent.h>
+#   include <unistd.h>
+#   include <sys/stat.h>
+#endif
+#if HAVE_INOTIFY
+#   include <sys/inotify.h>
+#endif
+#if HAVE_FANOTIFY
+#   include <sys/fanotify.h>
+#endif
+//------------------------------------------------------------------------------
+#include "port.hpp"
+#include "std_ext.hpp"
+#include "thread_pool.hpp"
+#include "watcher.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+#if HAVE_INOTIFY || HAVE_FANOTIFY
+//------------------------------------------------------------------------------
+void directory_watcher::startup()
+{
+    worker_result_ = thread_pool_t::instance()->enqueue(&directory_watcher::worker, this);
+}
+//------------------------------------------------------------------------------
+void directory_watcher::shutdown()
+{
+    if( !worker_result_.valid() )
+        return;
+
+    shutdown_ = true;
+    worker_result_.wait();
+    worker_result_ = decltype(worker_result_)();
+}
+//------------------------------------------------------------------------------
+void directory_watcher::worker()
+{
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+
+    // polled with timeout to notice shutdown
+    while( !shutdown_ ) {
+        pfd.revents = 0;
+
+        int r = ::poll(&pfd, 1, 250);
+
+        if( r < 0 && errno == EINTR )
+            continue;
+
+        if( r < 0 || (r > 0 && !read_events()) ) {
+            failed_ = true;
+            notify_(std::string(), true);
+            break;
+        }
+    }
+}
+//------------------------------------------------------------------------------
+#endif
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+#if HAVE_INOTIFY
+//------------------------------------------------------------------------------
+static const uint32_t inotify_mask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB
+    | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+//------------------------------------------------------------------------------
+// inotify is not recursive, so every directory of tree is watched
+class inotify_directory_watcher : public directory_watcher {
+public:
+    virtual ~inotify_directory_watcher() {
+        shutdown();
+
+        if( fd_ >= 0 )
+            ::close(fd_);
+    }
+
+    inotify_directory_watcher(const std::string & root_path, const notifier & notify) :
+        directory_watcher(root_path, notify) {}
+
+    bool setup();
+
+    const char * name() const {
+        return "inotify";
+    }
+protected:
+    bool watch(const std::string & path_name);
+    void unwatch(const std::string & path_name);
+    bool read_events();
+
+    std::unordered_map<int, std::string> paths_;    // watch descriptor -> directory
+    std::map<std::string, int> watches_;            // sorted, so subtree is a range
+};
+//------------------------------------------------------------------------------
+bool inotify_directory_watcher::setup()
+{
+    fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if( fd_ < 0 || !watch(root_path_) || paths_.empty() )
+        return false;
+
+    startup();
+
+    return true;
+}
+//------------------------------------------------------------------------------
+// returns false if watches limit reached
+bool inotify_directory_watcher::watch(const std::string & path_name)
+{
+    std::vector<std::string> stack = { path_name };
+
+    while( !stack.empty() ) {
+        auto path = std::move(stack.back());
+        stack.pop_back();
+
+        int wd = ::inotify_add_watch(fd_, path.c_str(), inotify_mask);
+
+        if( wd < 0 ) {
+            // vanished or inaccessible directories are skipped
+            if( errno == ENOSPC || errno == ENOMEM )
+                return false;
+
+            continue;
+        }
+
+        auto it = paths_.find(wd);
+
+        // same directory under new name
+        if( it != paths_.end() ) {
+            watches_.erase(it->second);
+            it->second = path;
+        }
+        else {
+            paths_.emplace(wd, path);
+        }
+
+        watches_[path] = wd;
+
+        DIR * handle = ::opendir(path.c_str());
+
+        if( handle == nullptr )
+            continue;
+
+        at_scope_exit( ::closedir(handle) );
+
+        while( auto ent = ::readdir(handle) ) {
+            if( ent->d_name[0] == '.' && (ent->d_name[1] == '\0'
+                    || (ent->d_name[1] == '.' && ent->d_name[2] == '\0')) )
+                continue;
+
+            auto child = path + path_delimiter + ent->d_name;
+            bool is_dir = ent->d_type == DT_DIR;
+
+            if( ent->d_type == DT_UNKNOWN ) {
+                struct stat st;
+                is_dir = ::lstat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+            }
+
+            if( is_dir )
+                stack.emplace_back(std::move(child));
+        }
+    }
+
+    return true;
+}
+//------------------------------------------------------------------------------
+void inotify_directory_watcher::unwatch(const std::string & path_name)
+{
+    auto remove = [&] (std::map<std::string, int>::iterator it) {
+        ::inotify_rm_watch(fd_, it->second);
+        paths_.erase(it->second);
+        return watches_.erase(it);
+    };
+
+    auto it = watches_.find(path_name);
+
+    if( it != watches_.end() )
+        remove(it);
+
+    auto prefix = path_name + path_delimiter;
+
+    for( it = watches_.lower_bound(prefix);
+            it != watches_.end() && it->first.compare(0, prefix.size(), prefix) == 0; )
+        it = remove(it);
+}
+//------------------------------------------------------------------------------
+bool inotify_directory_watcher::read_events()
+{
+    alignas(struct inotify_event) char buf[64 * 1024];
+
+    for(;;) {
+        auto n = ::read(fd_, buf, sizeof(buf));
+
+        if( n < 0 && errno == EINTR )
+            continue;
+
+        if( n <= 0 )
+            return n == 0 || errno == EAGAIN;
+
+        for( const char * p = buf; p < buf + n; ) {
+            auto ev = reinterpret_cast<const struct inotify_event *>(p);
+            p += sizeof(*ev) + ev->len;
+
+            if( (ev->mask & IN_Q_OVERFLOW) != 0 ) {
+                notify_(std::string(), true);
+                continue;
+            }
+
+            auto it = paths_.find(ev->wd);
+
+            if( it == paths_.end() )
+                continue;
+
+            if( (ev->mask & IN_IGNORED) != 0 ) {
+                auto w = watches_.find(it->second);
+
+                if( w != watches_.end() && w->second == ev->wd )
+                    watches_.erase(w);
+
+                paths_.erase(it);
+                continue;
+            }
+
+            // events of directory itself are reported to its parent too
+            if( ev->len == 0 )
+                continue;
+
+            std::string dir = it->second;
+            notify_(dir, false);
+
+            if( (ev->mask & IN_ISDIR) == 0 )
+                continue;
+
+            auto path_name = dir + path_delimiter + ev->name;
+
+            if( (ev->mask & (IN_DELETE | IN_MOVED_FROM)) != 0 )
+                unwatch(path_name);
+
+            if( (ev->mask & (IN_CREATE | IN_MOVED_TO)) != 0 ) {
+                // content may appear before watches are set, so listed whole
+                if( !watch(path_name) )
+                    notify_(std::string(), true);
+
+                notify_(path_name, true);
+            }
+        }
+    }
+}
+//------------------------------------------------------------------------------
+#endif // HAVE_INOTIFY
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+#if HAVE_FANOTIFY && defined(FAN_REPORT_DFID_NAME)
+//------------------------------------------------------------------------------
+static const uint64_t fanotify_mask = FAN_CREATE | FAN_DELETE | FAN_MODIFY | FAN_ATTRIB
+    | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR;
+//------------------------------------------------------------------------------
+// single mark covers whole filesystem, events carry handle of directory and
+// name of entry, requires CAP_SYS_ADMIN and linux 5.9
+class fanotify_directory_watcher : public directory_watcher {
+public:
+    virtual ~fanotify_directory_watcher() {
+        shutdown();
+
+        if( mount_fd_ >= 0 )
+            ::close(mount_fd_);
+
+        if( fd_ >= 0 )
+            ::close(fd_);
+    }
+
+    fanotify_directory_watcher(const std::string & root_path, const notifier & notify) :
+        directory_watcher(root_path, notify) {}
+
+    bool setup();
+
+    const char * name() const {
+        return "fanotify";
+    }
+protected:
+    static bool has_nested_mounts(const std::string & root_path);
+    std::string resolve(const struct file_handle * fh);
+    bool read_events();
+
+    std::string real_root_;
+    int mount_fd_ = -1;
+
+    // directory handle -> path name in tree or empty if outside
+    std::unordered_map<std::string, std::string> paths_;
+};
+//------------------------------------------------------------------------------
+bool fanotify_directory_watcher::has_nested_mounts(const std::string & root_path)
+{
+    std::ifstream mounts("/proc/self/mountinfo");
+    std::string line, prefix = root_path + path_delimiter;
+
+    while( std::getline(mounts, line) ) {
+        // mount id, parent id, device, root, mount point, ...
+        std::istringstream fields(line);
+        std::string field, mount_point;
+
+        for( int i = 0; i < 4; i++ )
+            fields >> field;
+
+        fields >> field;
+
+        // blanks and backslashes are escaped as octal
+        for( size_t i = 0; i < field.size(); i++ ) {
+            if( field[i] == '\\' && i + 3 < field.size() ) {
+                mount_point.push_back(char(std::stoi(field.substr(i + 1, 3), nullptr, 8)));
+                i += 3;
+            }
+            else {
+                mount_point.push_back(field[i]);
+            }
+        }
+
+        if( mount_point.compare(0, prefix.size(), prefix) == 0 )
+            return true;
+    }
+
+    return false;
+}
+//------------------------------------------------------------------------------
+bool fanotify_directory_watcher::setup()
+{
+    char * real_path = ::realpath(root_path_.c_str(), nullptr);
+
+    if( real_path == nullptr )
+        return false;
+
+    real_root_ = real_path;
+    ::free(real_path);
+
+    // file systems mounted inside tree are not covered by mark
+    if( real_root_.size() <= 1 || has_nested_mounts(real_root_) )
+        return false;
+
+    fd_ = ::fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+
+    if( fd_ < 0 )
+        return false;
+
+    mount_fd_ = ::open(real_root_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if( mount_fd_ < 0 )
+        return false;
+
+    if( ::fanotify_mark(fd_, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, fanotify_mask, AT_FDCWD, real_root_.c_str()) != 0 )
+        return false;
+
+    startup();
+
+    return true;
+}
+//------------------------------------------------------------------------------
+std::string fanotify_directory_watcher::resolve(const struct file_handle * fh)
+{
+    std::string key(reinterpret_cast<const char *>(fh), sizeof(*fh) + fh->handle_bytes);
+    auto it = paths_.find(key);
+
+    if( it != paths_.end() )
+        return it->second;
+
+    int fd = ::open_by_handle_at(mount_fd_, const_cast<struct file_handle *>(fh), O_PATH | O_CLOEXEC);
+
+    // directory already deleted
+    if( fd < 0 )
+        return std::string();
+
+    at_scope_exit( ::close(fd) );
+
+    char link[PATH_MAX];
+    auto n = ::readlink(("/proc/self/fd/" + std::to_string(fd)).c_str(), link, sizeof(link));
+
+    if( n <= 0 )
+        return std::string();
+
+    std::string path(link, size_t(n)), path_name;
+
+    if( path == real_root_ )
+        path_name = root_path_;
+    else if( path.compare(0, real_root_.size() + 1, real_root_ + path_delimiter) == 0 )
+        path_name = root_path_ + path.substr(real_root_.size());
+
+    if( paths_.size() >= 65536 )
+        paths_.clear();
+
+    paths_.emplace(std::move(key), path_name);
+
+    return path_name;
+}
+//------------------------------------------------------------------------------
+bool fanotify_directory_watcher::read_events()
+{
+    alignas(struct fanotify_event_metadata) char buf[64 * 1024];
+
+    for(;;) {
+        auto n = ::read(fd_, buf, sizeof(buf));
+
+        if( n < 0 && errno == EINTR )
+            continue;
+
+        if( n <= 0 )
+            return n == 0 || errno == EAGAIN;
+
+        auto md = reinterpret_cast<const struct fanotify_event_metadata *>(buf);
+
+        for( ; FAN_EVENT_OK(md, n); md = FAN_EVENT_NEXT(md, n) ) {
+            if( md->fd >= 0 )
+                ::close(md->fd);
+
+            if( (md->mask & FAN_Q_OVERFLOW) != 0 ) {
+                notify_(std::string(), true);
+                continue;
+            }
+
+            if( md->event_len <= md->metadata_len )
+                continue;
+
+            auto info = reinterpret_cast<const struct fanotify_event_info_fid *>(
+                reinterpret_cast<const char *>(md) + md->metadata_len);
+
+            if( info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME )
+                continue;
+
+            auto fh = reinterpret_cast<const struct file_handle *>(info->handle);
+            auto name = reinterpret_cast<const char *>(fh->f_handle + fh->handle_bytes);
+            bool is_dir = (md->mask & FAN_ONDIR) != 0;
+
+            // cached paths of moved or deleted subtree are stale
+            if( is_dir && (md->mask & (FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO)) != 0 )
+                paths_.clear();
+
+            auto dir = resolve(fh);
+
+            // events of whole filesystem are delivered, only tree ones matter
+            if( dir.empty() )
+                continue;
+
+            notify_(dir, false);
+
+            if( is_dir && (md->mask & (FAN_CREATE | FAN_MOVED_TO)) != 0 )
+                notify_(dir + path_delimiter + name, true);
+        }
+    }
+}
+//------------------------------------------------------------------------------
+#endif // HAVE_FANOTIFY
+//------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////
+//------------------------------------------------------------------------------
+std::unique_ptr<directory_watcher> directory_watcher::make(
+    const std::string & root_path,
+    const notifier & notify,
+    bool fanotify)
+{
+#if HAVE_FANOTIFY && defined(FAN_REPORT_DFID_NAME)
+    if( fanotify ) {
+        std::unique_ptr<fanotify_directory_watcher> watcher(new fanotify_directory_watcher(root_path, notify));
+
+        if( watcher->setup() )
+            return watcher;
+    }
+#endif
+#if HAVE_INOTIFY
+    std::unique_ptr<inotify_directory_watcher> watcher(new inotify_directory_watcher(root_path, notify));
+
+    if( watcher->setup() )
+        return watcher;
+#endif
+    return nullptr;
+}
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
@@ -28,6 +28,12 @@
 #include "cdc512.hpp"
 #include "rand.hpp"
 #include "indexer.hpp"
+#include "hasher.hpp"
+#include "hash_cache.hpp"
+#include "throttle.hpp"
+#include "glob.hpp"
+#include "watcher.hpp"
+#include "sequence.hpp"
 #include "tracker.hpp"
 #include "thread_pool.hpp"
 #include "server.hpp"
@@ -43,9 +49,15 @@ void run_tests()
     locale_traits_test();
     cdc512_test();
     rand_test();
+    sequence_test();
     thread_pool_test();
     socket_test();
+    glob_test();
+    hasher_test();
+    hash_cache_test();
+    throttle_test();
     indexer_test();
+    watcher_test();
     tracker_test();
     client_test();
     server_test();
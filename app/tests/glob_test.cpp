@@ -0,0 +1,153 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <set>
+//------------------------------------------------------------------------------
+#include "port.hpp"
+#include "glob.hpp"
+#include "indexer.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+namespace tests {
+//------------------------------------------------------------------------------
+void glob_test()
+{
+    bool fail = false;
+
+    try {
+        glob_matcher m(
+            "# comment\n"
+            "*.o\n"
+            "/build\n"
+            "cache/\n"
+            "doc/**/*.tmp\n"
+            "a?c\n"
+            "[x-z]*.log\r\n"
+            "!keep.o\n"
+            "lib/**\n"
+            "\\#hash\n"
+        );
+
+        struct {
+            const char * path;
+            bool is_dir;
+            bool match;
+        } cases[] = {
+            { "main.o"              , false, true  },
+            { "src/deep/main.o"     , false, true  },
+            { "main.c"              , false, false },
+            { "keep.o"              , false, false },
+            { "src/keep.o"          , false, false },
+            { "build"               , true , true  },
+            { "src/build"           , true , false },
+            { "cache"               , true , true  },
+            { "cache"               , false, false },
+            { "src/cache"           , true , true  },
+            { "doc/a.tmp"           , false, true  },
+            { "doc/x/y/a.tmp"       , false, true  },
+            { "src/doc/a.tmp"       , false, false },
+            { "abc"                 , false, true  },
+            { "a/c"                 , false, false },
+            { "ac"                  , false, false },
+            { "y1.log"              , false, true  },
+            { "a1.log"              , false, false },
+            { "lib"                 , true , false },
+            { "lib/x/y"             , false, true  },
+            { "#hash"               , false, true  },
+            { "comment"             , false, false },
+        };
+
+        for( const auto & c : cases )
+            if( m.match(c.path, c.is_dir) != c.match )
+                throw std::xruntime_error(std::string("Glob mismatch: ") + c.path, __FILE__, __LINE__);
+
+        if( !glob_matcher().empty() || glob_matcher().match("x", false) )
+            throw std::xruntime_error("Empty glob matches", __FILE__, __LINE__);
+
+        // excluded subtrees are not listed at all
+        std::string tree = temp_name();
+        std::vector<std::string> dirs = { tree }, files;
+
+        auto make_dir = [&] (const std::string & name) {
+            mkdir(tree + path_delimiter + name);
+            dirs.push_back(tree + path_delimiter + name);
+        };
+
+        auto write_file = [&] (const std::string & name) {
+            std::ofstream(tree + path_delimiter + name, std::ios::binary) << name;
+            files.push_back(tree + path_delimiter + name);
+        };
+
+        at_scope_exit(
+            for( const auto & name : files )
+                std::remove(name.c_str());
+
+            for( auto i = dirs.rbegin(); i != dirs.rend(); i++ )
+                std::remove(i->c_str());
+        );
+
+        mkdir(tree);
+        make_dir("src");
+        make_dir("build");
+        write_file("src/a.cpp");
+        write_file("src/a.o");
+        write_file("build/b.cpp");
+
+        directory_reader dr;
+        std::set<std::string> listed;
+
+        dr.recursive_ = dr.list_directories_ = true;
+        dr.mask_ = "*.cpp";
+        dr.exclude_ = "/build/";
+        dr.manipulator_ = [&] (directory_entry & e) {
+            listed.insert(e.path_name.substr(tree.size() + 1));
+        };
+
+        dr.read(tree);
+
+        std::set<std::string> expected = { "src", std::string("src") + path_delimiter + "a.cpp" };
+
+        if( listed != expected )
+            throw std::xruntime_error("Excluded subtree listed", __FILE__, __LINE__);
+    }
+    catch (const std::exception & e) {
+        std::cerr << e << std::endl;
+        fail = true;
+    }
+    catch (...) {
+        fail = true;
+    }
+
+    std::cerr << "glob test " << (fail ? "failed" : "passed") << std::endl;
+}
+//------------------------------------------------------------------------------
+} // namespace tests
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
@@ -0,0 +1,117 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+#include <iostream>
+#include <cstdio>
+//------------------------------------------------------------------------------
+#include "port.hpp"
+#include "cdc512.hpp"
+#include "hash_cache.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+namespace tests {
+//------------------------------------------------------------------------------
+void hash_cache_test()
+{
+    bool fail = false;
+
+    try {
+        std::string db_name = temp_name() + ".sqlite";
+
+        at_scope_exit(
+            std::remove(db_name.c_str());
+            std::remove((db_name + "-wal").c_str());
+            std::remove((db_name + "-shm").c_str());
+        );
+
+        auto digest = [] (const std::string & s) {
+            return std::key512(cdc512(s.cbegin(), s.cend()));
+        };
+
+        file_hash_job job;
+        job.block_size = 65536;
+        job.blocks = {
+            { 0, 65536, digest("a") },
+            { 65536, 100, digest("b") }
+        };
+        job.digest = digest("ab");
+
+        hash_cache::file_identity id = { 1, 2, 65636, 3, 4 };
+
+        {
+            hash_cache cache(db_name);
+
+            if( cache.seeded() )
+                throw std::xruntime_error("New cache seeded", __FILE__, __LINE__);
+
+            cache.store(job, id);
+            cache.seeded(true);
+        }
+
+        // must survive reopening, identity and hashing parameters must match
+        hash_cache cache(db_name);
+        file_hash_job loaded;
+        loaded.block_size = job.block_size;
+
+        if( !cache.seeded() || !cache.load(loaded, id) || loaded.digest != job.digest
+            || loaded.blocks.size() != 2 || loaded.blocks[1].offset != 65536
+            || loaded.blocks[1].length != 100 || loaded.blocks[1].digest != job.blocks[1].digest )
+            throw std::xruntime_error("Cached digests mismatch", __FILE__, __LINE__);
+
+        auto changed = id;
+        changed.ctime++;
+
+        if( cache.load(loaded, changed) )
+            throw std::xruntime_error("Changed file found in cache", __FILE__, __LINE__);
+
+        loaded.block_size = 4096;
+
+        if( cache.load(loaded, id) )
+            throw std::xruntime_error("Other block size found in cache", __FILE__, __LINE__);
+
+        // inode reused by other file
+        changed.ctime++;
+        job.blocks.clear();
+        cache.store(job, changed);
+
+        if( cache.load(loaded, id) || !cache.load(job, changed) || !job.blocks.empty() )
+            throw std::xruntime_error("Reused inode mismatch", __FILE__, __LINE__);
+    }
+    catch (const std::exception & e) {
+        std::cerr << e << std::endl;
+        fail = true;
+    }
+    catch (...) {
+        fail = true;
+    }
+
+    std::cerr << "hash cache test " << (fail ? "failed" : "passed") << std::endl;
+}
+//------------------------------------------------------------------------------
+} // namespace tests
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
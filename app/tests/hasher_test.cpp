@@ -0,0 +1,360 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <thread>
+#if !_WIN32
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+//------------------------------------------------------------------------------
+#include "port.hpp"
+#include "hasher.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+namespace tests {
+//------------------------------------------------------------------------------
+void hasher_test()
+{
+    bool fail = false;
+
+    try {
+        // not multiple of read window nor of block size
+        std::vector<uint8_t> data(3 * 256 * 1024 + 12345);
+        uint64_t e = entropy_fast();
+
+        for( auto & c : data ) {
+            e = e * 6364136223846793005ull + 1442695040888963407ull;
+            c = uint8_t(e >> 56);
+        }
+
+        std::string file_name = temp_name() + ".bin";
+        at_scope_exit( std::remove(file_name.c_str()) );
+
+        {
+            std::ofstream f(file_name, std::ios::binary);
+            f.write(reinterpret_cast<const char *>(data.data()), data.size());
+        }
+
+        std::vector<file_hash_job> jobs(4);
+        jobs[0].path_name = file_name;
+        jobs[1].path_name = file_name;
+        jobs[1].block_size = 65536;
+        jobs[1].file_size = 1; // stale hint must not matter
+        jobs[2].path_name = file_name + ".absent";
+        // hashed from mapping where supported
+        jobs[3].path_name = file_name;
+        jobs[3].file_size = data.size();
+        jobs[3].mmap_threshold = 1;
+
+        auto expected = [&] (const file_hash_job & job) {
+            size_t n = 0;
+
+            for( size_t i = 0; i < data.size(); i += job.block_size, n++ ) {
+                auto r = std::min(data.size() - i, size_t(job.block_size));
+
+                if( n >= job.blocks.size()
+                    || job.blocks[n].offset != i
+                    || job.blocks[n].length != r
+                    || job.blocks[n].digest != cdc512(&data[i], &data[i] + r) )
+                    return false;
+            }
+
+            return n == job.blocks.size();
+        };
+
+        std::key512 digests[2];
+
+        for( auto async_io : { false, true } ) {
+            auto hasher = file_hasher::make(async_io);
+            size_t count = 0;
+
+            hasher->hash(jobs, [&] (file_hash_job & job) {
+                count++;
+
+                if( &job == &jobs[2] ) {
+                    if( job.error != ENOENT )
+                        throw std::xruntime_error(std::string(hasher->name()) + " hasher error expected", __FILE__, __LINE__);
+                }
+                else if( job.error != 0 || !expected(job) )
+                    throw std::xruntime_error(std::string(hasher->name()) + " hasher blocks mismatch", __FILE__, __LINE__);
+            });
+
+            if( count != jobs.size() )
+                throw std::xruntime_error(std::string(hasher->name()) + " hasher missed jobs", __FILE__, __LINE__);
+
+            digests[async_io] = jobs[0].digest;
+        }
+
+        if( digests[0] != digests[1] )
+            throw std::xruntime_error("Hashers digests mismatch", __FILE__, __LINE__);
+
+        // pipeline must hand back every job on pushing thread, jobs of
+        // known size are opened and read ahead by pipeline before hashing
+        for( auto async_io : { false, true } )
+        for( size_t threads : { 0, 3 } ) {
+            file_hash_pipeline pipeline(threads, async_io, 4);
+            auto id = std::this_thread::get_id();
+            size_t count = 0;
+
+            file_hasher::completion done = [&] (file_hash_job & job) {
+                if( std::this_thread::get_id() != id || job.fd >= 0 )
+                    throw std::xruntime_error("Pipeline result mismatch", __FILE__, __LINE__);
+
+                if( job.entry_id % 8 == 7 ) {
+                    if( job.error != ENOENT )
+                        throw std::xruntime_error("Pipeline error expected", __FILE__, __LINE__);
+                }
+                else if( job.error != 0 || job.digest != digests[0] || !expected(job) )
+                    throw std::xruntime_error("Pipeline result mismatch", __FILE__, __LINE__);
+
+                count++;
+            };
+
+            for( size_t i = 0; i < 32; i++ ) {
+                file_hash_job job;
+                job.path_name = i % 8 == 7 ? file_name + ".absent" : file_name;
+                job.entry_id = i;
+                job.file_size = i % 2 != 0 ? data.size() : 0;
+                pipeline.push(std::move(job), done);
+            }
+
+            pipeline.finish(done);
+
+            if( count != 32 )
+                throw std::xruntime_error("Pipeline missed jobs", __FILE__, __LINE__);
+        }
+
+        // reads leaving page cache as it was must give the same
+        for( auto async_io : { false, true } ) {
+            std::vector<file_hash_job> drop_jobs(2);
+
+            for( auto & job : drop_jobs ) {
+                job.path_name = file_name;
+                job.file_size = data.size();
+                job.drop_cache = true;
+            }
+
+            drop_jobs[1].mmap_threshold = 1;
+
+            file_hasher::make(async_io)->hash(drop_jobs, [] (file_hash_job &) {});
+
+            for( const auto & job : drop_jobs )
+                if( job.error != 0 || job.digest != digests[0] )
+                    throw std::xruntime_error("Page cache neutral hashing mismatch", __FILE__, __LINE__);
+        }
+
+        // tree mode must give the same blocks hashed by several threads, and
+        // digest of tree, so parts of file are verified apart
+        for( auto async_io : { false, true } ) {
+            std::vector<file_hash_job> tree_jobs(1);
+            tree_jobs[0].path_name = file_name;
+            tree_jobs[0].block_size = 65536;
+            tree_jobs[0].file_size = data.size();
+            tree_jobs[0].tree_threshold = 1;
+            tree_jobs[0].tree_threads = 3;
+
+            file_hasher::make(async_io)->hash(tree_jobs, [] (file_hash_job &) {});
+
+            const auto & job = tree_jobs[0];
+
+            if( job.error != 0 || !expected(job) )
+                throw std::xruntime_error("Tree hashing blocks mismatch", __FILE__, __LINE__);
+
+            if( job.digest != blocks_tree_node(blocks_tree_digest(job.blocks, 0, 8), blocks_tree_digest(job.blocks, 8, job.blocks.size())) )
+                throw std::xruntime_error("Tree digest mismatch", __FILE__, __LINE__);
+        }
+
+        // content defined chunks must be the same for both hashers and
+        // insertion must change only chunks around it
+        std::vector<file_block> chunks[2];
+
+        for( auto async_io : { false, true } ) {
+            std::vector<file_hash_job> cdc_jobs(1);
+            cdc_jobs[0].path_name = file_name;
+            cdc_jobs[0].chunk_avg = 8192;
+
+            file_hasher::make(async_io)->hash(cdc_jobs, [&] (file_hash_job & job) {
+                if( job.error != 0 )
+                    throw std::xruntime_error("Chunking failed", __FILE__, __LINE__);
+
+                chunks[async_io] = job.blocks;
+            });
+        }
+
+        auto same_chunks = [] (const std::vector<file_block> & a, const std::vector<file_block> & b) {
+            if( a.size() != b.size() )
+                return false;
+
+            for( size_t i = 0; i < a.size(); i++ )
+                if( a[i].offset != b[i].offset || a[i].length != b[i].length || a[i].digest != b[i].digest )
+                    return false;
+
+            return true;
+        };
+
+        if( !same_chunks(chunks[0], chunks[1]) || chunks[0].size() < 2
+            || chunks[0].back().offset + chunks[0].back().length != data.size() )
+            throw std::xruntime_error("Chunking mismatch", __FILE__, __LINE__);
+
+        for( const auto & b : chunks[0] )
+            if( b.digest != cdc512(&data[b.offset], &data[b.offset] + b.length) )
+                throw std::xruntime_error("Chunk digest mismatch", __FILE__, __LINE__);
+
+        data.insert(data.begin() + data.size() / 2, 100, 0x55);
+
+        {
+            std::ofstream f(file_name, std::ios::binary);
+            f.write(reinterpret_cast<const char *>(data.data()), data.size());
+        }
+
+        std::vector<file_hash_job> cdc_jobs(1);
+        cdc_jobs[0].path_name = file_name;
+        cdc_jobs[0].chunk_avg = 8192;
+        file_hasher::make(false)->hash(cdc_jobs, [] (file_hash_job &) {});
+
+        size_t changed = 0;
+
+        for( const auto & b : cdc_jobs[0].blocks ) {
+            bool found = false;
+
+            for( const auto & a : chunks[0] )
+                found = found || a.digest == b.digest;
+
+            changed += found ? 0 : 1;
+        }
+
+        if( changed > 3 )
+            throw std::xruntime_error("Chunking is not content defined", __FILE__, __LINE__);
+
+        // appended file keeps its checked blocks, rewritten one is hashed
+        // whole, both must give the same as hashing from scratch
+        for( auto async_io : { false, true } ) {
+            for( auto rewrite : { false, true } ) {
+                auto hasher = file_hasher::make(async_io);
+                std::vector<file_hash_job> append_jobs(2);
+
+                for( auto & job : append_jobs ) {
+                    job.path_name = file_name;
+                    job.block_size = 65536;
+                }
+
+                hasher->hash(append_jobs, [] (file_hash_job &) {});
+
+                data.insert(data.end(), 100000, uint8_t(rewrite ? 0x33 : 0x77));
+
+                if( rewrite )
+                    data[0] ^= 1;
+
+                {
+                    std::ofstream f(file_name, std::ios::binary);
+                    f.write(reinterpret_cast<const char *>(data.data()), data.size());
+                }
+
+                append_jobs[0].append = true;
+                append_jobs[1].blocks.clear();
+
+                hasher->hash(append_jobs, [] (file_hash_job &) {});
+
+                if( append_jobs[0].error != 0 || append_jobs[1].error != 0
+                    || !same_chunks(append_jobs[0].blocks, append_jobs[1].blocks)
+                    || append_jobs[0].digest != append_jobs[1].digest
+                    || append_jobs[1].blocks.back().offset + append_jobs[1].blocks.back().length != data.size() )
+                    throw std::xruntime_error(std::string(hasher->name()) + " hasher appended file mismatch", __FILE__, __LINE__);
+            }
+        }
+#if !_WIN32
+        // holes of sparse file are hashed unread as blocks of zeros, digests
+        // must be the same as of file written whole
+        std::vector<uint8_t> sparse(3 * 1024 * 1024 + 70000);
+        std::copy(data.begin(), data.begin() + 100000, sparse.begin());
+        std::copy(data.begin(), data.begin() + 50000, sparse.begin() + 2 * 1024 * 1024 + 10);
+
+        {
+            std::remove(file_name.c_str());
+            int fd = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+            if( fd == -1
+                || ::pwrite(fd, sparse.data(), 100000, 0) != 100000
+                || ::pwrite(fd, sparse.data() + 2 * 1024 * 1024 + 10, 50000, 2 * 1024 * 1024 + 10) != 50000
+                || ::ftruncate(fd, off_t(sparse.size())) != 0 )
+                throw std::xruntime_error("Sparse file not written", __FILE__, __LINE__);
+
+            ::close(fd);
+        }
+
+        for( auto async_io : { false, true } ) {
+            std::vector<file_hash_job> sparse_jobs(3);
+
+            for( auto & job : sparse_jobs ) {
+                job.path_name = file_name;
+                job.block_size = 65536;
+                job.file_size = sparse.size();
+            }
+
+            sparse_jobs[1].mmap_threshold = 1;
+            sparse_jobs[2].tree_threshold = 1;
+            sparse_jobs[2].tree_threads = 3;
+
+            file_hasher::make(async_io)->hash(sparse_jobs, [] (file_hash_job &) {});
+
+            for( const auto & job : sparse_jobs ) {
+                size_t n = 0, zeros = 0;
+
+                for( size_t i = 0; i < sparse.size(); i += job.block_size, n++ ) {
+                    auto r = std::min(sparse.size() - i, size_t(job.block_size));
+
+                    if( job.error != 0 || n >= job.blocks.size()
+                        || job.blocks[n].offset != i
+                        || job.blocks[n].length != r
+                        || job.blocks[n].digest != cdc512(&sparse[i], &sparse[i] + r) )
+                        throw std::xruntime_error("Sparse file blocks mismatch", __FILE__, __LINE__);
+
+                    zeros += job.blocks[n].digest == zero_block_digest(r) ? 1 : 0;
+                }
+
+                if( n != job.blocks.size() || zeros < 40 )
+                    throw std::xruntime_error("Sparse file blocks mismatch", __FILE__, __LINE__);
+            }
+        }
+#endif
+    }
+    catch (const std::exception & e) {
+        std::cerr << e << std::endl;
+        fail = true;
+    }
+    catch (...) {
+        fail = true;
+    }
+
+    std::cerr << "hasher test " << (fail ? "failed" : "passed") << std::endl;
+}
+//------------------------------------------------------------------------------
+} // namespace tests
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
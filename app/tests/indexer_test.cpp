@@ -23,8 +23,15 @@
  */
 //------------------------------------------------------------------------------
 #include <iostream>
+#include <fstream>
+#include <cstdio>
 #include <vector>
 #include <algorithm>
+#include <tuple>
+#if !_WIN32
+#   include <unistd.h>
+#   include <sys/time.h>
+#endif
 //------------------------------------------------------------------------------
 #include "port.hpp"
 #include "indexer.hpp"
@@ -42,12 +49,12 @@ void indexer_test()
 
 		struct entry {
             std::string name_;
-			decltype(dr.mtime_) mtime_;
-			decltype(dr.fsize_) size_;
-			decltype(dr.is_reg_) is_reg_;
+			decltype(directory_entry::mtime) mtime_;
+			decltype(directory_entry::fsize) size_;
+			decltype(directory_entry::is_reg) is_reg_;
 
 			entry() {}
-            entry(std::string name, decltype(mtime_) mtime, decltype(size_) fsize, decltype(dr.is_reg_) is_reg) :
+            entry(std::string name, decltype(mtime_) mtime, decltype(size_) fsize, decltype(is_reg_) is_reg) :
 				name_(std::move(name)),
 				mtime_(std::move(mtime)),
 				size_(std::move(fsize)),
@@ -58,13 +65,30 @@ void indexer_test()
 		std::vector<entry> lst;
 
         dr.recursive_ = dr.list_directories_ = true;
-        dr.manipulator_ = [&] {
-            lst.emplace_back(entry(dr.path_name_, dr.mtime_, dr.fsize_, dr.is_reg_));
-			return nullptr;
+        dr.manipulator_ = [&] (directory_entry & e) {
+            lst.emplace_back(entry(e.path_name, e.mtime, e.fsize, e.is_reg));
 		};
 
         dr.read(get_cwd());
 
+        // parallel traversal must deliver the same entries
+        std::vector<entry> plst;
+
+        dr.threads_ = 4;
+        dr.manipulator_ = [&] (directory_entry & e) {
+            plst.emplace_back(entry(e.path_name, e.mtime, e.fsize, e.is_reg));
+        };
+
+        dr.read(get_cwd());
+
+        if( plst.size() != lst.size() )
+            throw std::xruntime_error("Parallel traversal mismatch", __FILE__, __LINE__);
+
+        for( size_t i = 0; i < lst.size(); i++ ) {
+            if( plst[i].name_ != lst[i].name_ )
+                throw std::xruntime_error("Parallel traversal mismatch", __FILE__, __LINE__);
+        }
+
 		std::function<bool (const entry & a, const entry & b)> sorter = [&] (const auto & a, const auto & b) {
 			int r = (a.is_reg_ ? 1 : 0) - (b.is_reg_ ? 1 : 0);
 
@@ -105,6 +129,592 @@ void indexer_test()
 		
         di.reindex(db, get_cwd());
 
+        // reindex of changed directories only must give the same result
+        // as full one
+        std::string tree = temp_name();
+        std::vector<std::string> files, dirs = { tree };
+
+        auto write_file = [&] (const std::string & name, const std::string & content) {
+            std::ofstream f(tree + path_delimiter + name, std::ios::binary);
+            f << content;
+
+            if( std::find(files.begin(), files.end(), name) == files.end() )
+                files.push_back(name);
+        };
+
+        auto make_dir = [&] (const std::string & name) {
+            mkdir(tree + path_delimiter + name);
+            dirs.push_back(tree + path_delimiter + name);
+        };
+
+        std::string inc_db_name = temp_name() + ".sqlite";
+        std::string full_db_name = temp_name() + ".sqlite";
+
+        at_scope_exit(
+            for( const auto & name : files )
+                std::remove((tree + path_delimiter + name).c_str());
+
+            for( auto i = dirs.rbegin(); i != dirs.rend(); i++ )
+                std::remove(i->c_str());
+
+            std::remove(inc_db_name.c_str());
+            std::remove(full_db_name.c_str());
+        );
+
+        mkdir(tree);
+        make_dir("d");
+        make_dir(std::string("d") + path_delimiter + "e");
+        write_file("a", "a");
+        write_file(std::string("d") + path_delimiter + "b", "b");
+        write_file(std::string("d") + path_delimiter + "e" + path_delimiter + "c", "c");
+
+        sqlite3pp::database inc_db(inc_db_name);
+        di.reindex(inc_db, tree);
+
+        std::remove((tree + path_delimiter + "a").c_str());
+        files.erase(files.begin());
+        write_file(std::string("d") + path_delimiter + "b", "bb");
+        write_file(std::string("d") + path_delimiter + "e" + path_delimiter + "f", "f");
+        make_dir("n");
+        make_dir(std::string("n") + path_delimiter + "m");
+        write_file(std::string("n") + path_delimiter + "m" + path_delimiter + "x", "x");
+
+        di.reindex(inc_db, tree, {
+            { tree, false },
+            { tree + path_delimiter + "d", false },
+            { tree + path_delimiter + "d" + path_delimiter + "e", false },
+            { tree + path_delimiter + "n", true }
+        });
+
+        sqlite3pp::database full_db(full_db_name);
+        di.reindex(full_db, tree);
+
+        auto files_digests = [] (sqlite3pp::database & db) {
+            sqlite3pp::query st(db, R"EOS(
+                SELECT name, file_size, digest FROM entries WHERE is_dir IS NULL ORDER BY name
+            )EOS");
+
+            std::string s;
+
+            for( auto i = st.begin(); i; i++ )
+                s.append(i->get<const char *>("name")).append(" ")
+                    .append(std::to_string(i->get<uint64_t>("file_size"))).append(" ")
+                    .append(std::to_string(i->get<std::key512>("digest"))).append("\n");
+
+            return s;
+        };
+
+        if( files_digests(inc_db) != files_digests(full_db) )
+            throw std::xruntime_error("Incremental reindex mismatch", __FILE__, __LINE__);
+
+        // digest of directory depends on its content only, change of file
+        // reaches its ancestors only
+        auto dir_digest = [] (sqlite3pp::database & db, const char * name) {
+            sqlite3pp::query st(db, R"EOS(
+                SELECT digest FROM entries WHERE name = :name AND is_dir IS NOT NULL
+            )EOS");
+            st.bind("name", name, sqlite3pp::nocopy);
+
+            auto i = st.begin();
+
+            return i ? i->get<std::key512>("digest") : std::key512(std::zero_initialized);
+        };
+
+        for( auto name : { "d", "e", "n", "m" } )
+            if( dir_digest(inc_db, name) != dir_digest(full_db, name) )
+                throw std::xruntime_error("Directory digest mismatch", __FILE__, __LINE__);
+
+        auto d_digest = dir_digest(full_db, "d"), e_digest = dir_digest(full_db, "e"), n_digest = dir_digest(full_db, "n");
+
+        di.reindex(full_db, tree);
+
+        if( dir_digest(full_db, "d") != d_digest || dir_digest(full_db, "e") != e_digest )
+            throw std::xruntime_error("Directory digest changed", __FILE__, __LINE__);
+
+        write_file(std::string("d") + path_delimiter + "e" + path_delimiter + "c", "cc");
+        di.reindex(full_db, tree);
+
+        if( dir_digest(full_db, "d") == d_digest || dir_digest(full_db, "e") == e_digest
+            || dir_digest(full_db, "n") != n_digest )
+            throw std::xruntime_error("Directory digest not updated", __FILE__, __LINE__);
+
+        // full pass resumes interrupted one past its last directory stored,
+        // change in part passed is met by the pass after
+        sqlite3pp::command st_checkpoint(full_db, R"EOS(
+            REPLACE INTO checkpoints (root_path, generation, path) VALUES (:root_path, 1, :path)
+        )EOS");
+        std::string checkpoint = tree + path_delimiter + "d" + path_delimiter + "e";
+        st_checkpoint.bind("root_path", tree, sqlite3pp::nocopy);
+        st_checkpoint.bind("path", checkpoint, sqlite3pp::nocopy);
+        st_checkpoint.execute();
+
+        write_file(std::string("d") + path_delimiter + "e" + path_delimiter + "g", "g");
+        write_file(std::string("n") + path_delimiter + "h", "h");
+
+        auto indexed = [&] (const char * name) {
+            sqlite3pp::query st(full_db, R"EOS(
+                SELECT COUNT(*) FROM entries WHERE name = :name AND digest IS NOT NULL
+            )EOS");
+            st.bind("name", name, sqlite3pp::nocopy);
+
+            return st.begin()->get<uint64_t>(0) != 0;
+        };
+
+        di.reindex(full_db, tree);
+
+        if( indexed("g") || !indexed("h") )
+            throw std::xruntime_error("Resumed pass mismatch", __FILE__, __LINE__);
+
+        di.reindex(full_db, tree);
+
+        if( !indexed("g") )
+            throw std::xruntime_error("Pass after resumed one mismatch", __FILE__, __LINE__);
+
+        // directory replaced by file must not leave its stored subtree
+        std::string m = tree + path_delimiter + "n" + path_delimiter + "m";
+        std::remove((m + path_delimiter + "x").c_str());
+        std::remove(m.c_str());
+        std::ofstream(m, std::ios::binary) << "m";
+
+        di.reindex(full_db, tree);
+
+        sqlite3pp::query st_orphans(full_db, R"EOS(
+            SELECT COUNT(*) FROM entries AS e JOIN entries AS p ON e.parent_id = p.id WHERE p.is_dir IS NULL
+        )EOS");
+
+        if( st_orphans.begin()->get<uint64_t>(0) != 0 )
+            throw std::xruntime_error("Orphaned entries left", __FILE__, __LINE__);
+
+        // and file replaced by directory must not leave its blocks
+        std::string h = std::string("n") + path_delimiter + "h";
+        std::remove((tree + path_delimiter + h).c_str());
+        make_dir(h);
+        write_file(h + path_delimiter + "i", "i");
+
+        di.reindex(full_db, tree);
+
+        sqlite3pp::query st_dir_blocks(full_db, R"EOS(
+            SELECT COUNT(*) FROM blocks_digests AS b JOIN entries AS e ON b.entry_id = e.id WHERE e.is_dir IS NOT NULL
+        )EOS");
+
+        if( st_dir_blocks.begin()->get<uint64_t>(0) != 0 )
+            throw std::xruntime_error("Blocks of directory left", __FILE__, __LINE__);
+
+#if !_WIN32
+        // second link to the same inode reuses digests of the first one
+        std::string link_name = "l";
+        link((tree + path_delimiter + "d" + path_delimiter + "b").c_str(), (tree + path_delimiter + link_name).c_str());
+        files.push_back(link_name);
+
+        di.reindex(full_db, tree);
+
+        sqlite3pp::query st_links(full_db, R"EOS(
+            SELECT
+                COUNT(DISTINCT digest),
+                COUNT(DISTINCT (SELECT COUNT(*) FROM blocks_digests WHERE entry_id = id))
+            FROM
+                entries
+            WHERE
+                name IN ('b', 'l')
+        )EOS");
+
+        auto links = st_links.begin();
+
+        if( links->get<uint64_t>(0) != 1 || links->get<uint64_t>(1) != 1 )
+            throw std::xruntime_error("Hardlink digests mismatch", __FILE__, __LINE__);
+
+        // renamed directory keeps its entry and subtree, back and forth to
+        // meet new name before and after the old one in listing
+        auto dir_id = [&] (const char * name) {
+            sqlite3pp::query st(full_db, R"EOS(
+                SELECT id, (SELECT COUNT(*) FROM entries WHERE parent_id = e.id) AS childs
+                FROM entries AS e WHERE name = :name
+            )EOS");
+            st.bind("name", name, sqlite3pp::nocopy);
+
+            auto i = st.begin();
+
+            return i ? std::make_pair(i->get<uint64_t>("id"), i->get<uint64_t>("childs")) : std::make_pair(uint64_t(0), uint64_t(0));
+        };
+
+        auto d = dir_id("d");
+
+        for( auto names : { std::make_pair("d", "r"), std::make_pair("r", "d") } ) {
+            std::rename((tree + path_delimiter + names.first).c_str(), (tree + path_delimiter + names.second).c_str());
+
+            di.reindex(full_db, tree);
+
+            if( dir_id(names.second) != d || dir_id(names.first).first != 0 )
+                throw std::xruntime_error("Moved directory entry mismatch", __FILE__, __LINE__);
+        }
+#endif
+
+        // deleted last entry of directory is not met by merge with listing,
+        // of subdirectory and then of root, by full and incremental pass
+        std::string z = tree + path_delimiter + "z";
+        std::string s = std::string("z") + path_delimiter + "s";
+        make_dir("z");
+        make_dir(s);
+        write_file(s + path_delimiter + "t", "t");
+        write_file(std::string("z") + path_delimiter + "u", "u");
+
+        std::string z_full_db_name = temp_name() + ".sqlite";
+        std::string z_inc_db_name = temp_name() + ".sqlite";
+
+        at_scope_exit(
+            std::remove(z_full_db_name.c_str());
+            std::remove(z_inc_db_name.c_str());
+        );
+
+        sqlite3pp::database z_full_db(z_full_db_name), z_inc_db(z_inc_db_name);
+        di.reindex(z_full_db, z);
+        di.reindex(z_inc_db, z);
+
+        auto left = [] (sqlite3pp::database & db, const char * name) {
+            sqlite3pp::query st(db, "SELECT COUNT(*) FROM entries WHERE name = :name");
+            st.bind("name", name, sqlite3pp::nocopy);
+
+            return st.begin()->get<uint64_t>(0) != 0;
+        };
+
+        if( !left(z_full_db, "t") || !left(z_inc_db, "u") )
+            throw std::xruntime_error("Entries not indexed", __FILE__, __LINE__);
+
+        std::remove((tree + path_delimiter + s + path_delimiter + "t").c_str());
+
+        di.reindex(z_full_db, z);
+        di.reindex(z_inc_db, z, { { tree + path_delimiter + s, false } });
+
+        if( left(z_full_db, "t") || left(z_inc_db, "t") )
+            throw std::xruntime_error("Last entry of subdirectory left", __FILE__, __LINE__);
+
+        // directories are stored with the same size by both passes, so
+        // neither takes ones of the other for modified
+        auto dirs_sizes = [] (sqlite3pp::database & db) {
+            sqlite3pp::query st(db, R"EOS(
+                SELECT name, file_size FROM entries WHERE is_dir IS NOT NULL ORDER BY name
+            )EOS");
+
+            std::string sizes;
+
+            for( auto i = st.begin(); i; i++ )
+                sizes.append(i->get<const char *>("name")).append(" ")
+                    .append(std::to_string(i->get<uint64_t>("file_size"))).append("\n");
+
+            return sizes;
+        };
+
+        if( dirs_sizes(z_inc_db) != dirs_sizes(z_full_db) )
+            throw std::xruntime_error("Directory size mismatch", __FILE__, __LINE__);
+
+        std::remove((z + path_delimiter + "u").c_str());
+        std::remove((tree + path_delimiter + s).c_str());
+
+        di.reindex(z_full_db, z);
+        di.reindex(z_inc_db, z, { { z, false } });
+
+        for( auto name : { "s", "u" } )
+            if( left(z_full_db, name) || left(z_inc_db, name) )
+                throw std::xruntime_error("Last entry of root left", __FILE__, __LINE__);
+
+        // file replaced by directory in incremental pass
+        std::string v = std::string("z") + path_delimiter + "v";
+        write_file(v, "v");
+        di.reindex(z_inc_db, z, { { z, false } });
+
+        std::remove((tree + path_delimiter + v).c_str());
+        make_dir(v);
+        write_file(v + path_delimiter + "w", "w");
+        di.reindex(z_inc_db, z, { { z, false } });
+
+        sqlite3pp::query st_inc_dir_blocks(z_inc_db, R"EOS(
+            SELECT
+                (SELECT COUNT(*) FROM blocks_digests AS b JOIN entries AS e ON b.entry_id = e.id WHERE e.is_dir IS NOT NULL),
+                (SELECT COUNT(*) FROM entries WHERE name = 'v' AND is_dir IS NOT NULL)
+        )EOS");
+
+        auto inc_dir_blocks = st_inc_dir_blocks.begin();
+
+        if( inc_dir_blocks->get<uint64_t>(0) != 0 || inc_dir_blocks->get<uint64_t>(1) != 1 )
+            throw std::xruntime_error("Blocks of directory left by incremental pass", __FILE__, __LINE__);
+
+        // blocks flagged for remote trackers after change of file, tracker
+        // registered flags all blocks stored, so flags are cleared before
+        std::string k = tree + path_delimiter + "k";
+        make_dir("k");
+
+        auto random_content = [] (size_t size, uint32_t seed) {
+            std::string content(size, '\0');
+
+            for( auto & c : content ) {
+                seed = seed * 1103515245 + 12345;
+                c = char(seed >> 16);
+            }
+
+            return content;
+        };
+
+        auto flagged = [] (sqlite3pp::database & db) {
+            sqlite3pp::query st(db, "SELECT block_no FROM remote_tracking ORDER BY block_no");
+            std::vector<uint64_t> blocks;
+
+            for( auto i = st.begin(); i; i++ )
+                blocks.push_back(i->get<uint64_t>(0));
+
+            return blocks;
+        };
+
+        auto track = [] (sqlite3pp::database & db) {
+            sqlite3pp::command(db, "REPLACE INTO remote_trackers (key, mtime) VALUES (x'01', 0)").execute();
+            sqlite3pp::command(db, "DELETE FROM remote_tracking").execute();
+        };
+
+        std::string k_db_name = temp_name() + ".sqlite";
+        at_scope_exit( std::remove(k_db_name.c_str()) );
+
+        // insertion shifts content defined chunks after it, only chunks
+        // around it are new
+        std::string cdc_name = std::string("k") + path_delimiter + "cdc";
+        auto cdc_content = random_content(1024 * 1024, 1);
+        write_file(cdc_name, cdc_content);
+
+        directory_indexer ci;
+        ci.modified_only(false);
+        ci.chunk_avg(4096);
+
+        {
+            sqlite3pp::database k_db(k_db_name);
+            ci.reindex(k_db, k);
+            track(k_db);
+
+            cdc_content.insert(cdc_content.size() / 2, "inserted");
+            write_file(cdc_name, cdc_content);
+            ci.reindex(k_db, k);
+
+            sqlite3pp::query st(k_db, "SELECT COUNT(*) FROM blocks_digests");
+            auto chunks = st.begin()->get<uint64_t>(0);
+            auto changed = flagged(k_db).size();
+
+            if( chunks < 100 || changed == 0 || changed > 4 )
+                throw std::xruntime_error("Shifted chunks flagged for resync", __FILE__, __LINE__);
+        }
+
+        // change of one block of file flags that block only, stored rows
+        // of the others are left as they were
+        std::string fixed_name = std::string("k") + path_delimiter + "fixed";
+        auto fixed_content = random_content(64 * 4096, 8);
+        write_file(fixed_name, fixed_content);
+
+        std::string f_db_name = temp_name() + ".sqlite";
+        at_scope_exit( std::remove(f_db_name.c_str()) );
+
+        auto blocks_rows = [] (sqlite3pp::database & db, const char * name) {
+            sqlite3pp::query st(db, R"EOS(
+                SELECT
+                    b.block_no, b.mtime, b.digest
+                FROM
+                    entries AS e INNER JOIN blocks_digests AS b ON b.entry_id = e.id
+                WHERE
+                    e.name = :name
+                ORDER BY
+                    b.block_no
+            )EOS");
+            st.bind("name", name, sqlite3pp::nocopy);
+
+            std::vector<std::tuple<uint64_t, uint64_t, std::key512>> rows;
+
+            for( auto i = st.begin(); i; i++ )
+                rows.emplace_back(i->get<uint64_t>(0), i->get<uint64_t>(1), i->get<std::key512>(2));
+
+            return rows;
+        };
+
+        {
+            sqlite3pp::database f_db(f_db_name);
+            di.reindex(f_db, k);
+            track(f_db);
+
+            auto before = blocks_rows(f_db, "fixed");
+
+            // block number starts from one
+            fixed_content.replace(37 * 4096 + 100, 10, "0123456789");
+            write_file(fixed_name, fixed_content);
+            di.reindex(f_db, k);
+
+            auto after = blocks_rows(f_db, "fixed");
+
+            if( flagged(f_db) != std::vector<uint64_t> { 38 } )
+                throw std::xruntime_error("Unchanged blocks flagged for resync", __FILE__, __LINE__);
+
+            if( before.size() != 64 || after.size() != 64 || std::get<2>(before[37]) == std::get<2>(after[37]) )
+                throw std::xruntime_error("Changed block not stored", __FILE__, __LINE__);
+
+            before.erase(before.begin() + 37);
+            after.erase(after.begin() + 37);
+
+            if( before != after )
+                throw std::xruntime_error("Unchanged blocks rewritten", __FILE__, __LINE__);
+        }
+
+        // file grown and rewritten in place meanwhile is not taken for
+        // appended to, its digest is one of fresh index
+        std::string grown_name = std::string("k") + path_delimiter + "grown";
+        auto grown_content = random_content(3 * 1024 * 1024, 2);
+        write_file(grown_name, grown_content);
+
+        std::string g_db_name = temp_name() + ".sqlite";
+        std::string g_fresh_db_name = temp_name() + ".sqlite";
+
+        at_scope_exit(
+            std::remove(g_db_name.c_str());
+            std::remove(g_fresh_db_name.c_str());
+        );
+
+        auto file_digest = [] (sqlite3pp::database & db, const char * name) {
+            sqlite3pp::query st(db, "SELECT digest FROM entries WHERE name = :name");
+            st.bind("name", name, sqlite3pp::nocopy);
+
+            auto i = st.begin();
+
+            return i ? i->get<std::key512>("digest") : std::key512(std::zero_initialized);
+        };
+
+        {
+            directory_indexer gi;
+            gi.modified_only(false);
+
+            sqlite3pp::database g_db(g_db_name);
+            gi.reindex(g_db, k);
+
+            grown_content.replace(grown_content.size() / 2, 4096, random_content(4096, 3));
+            grown_content.append(random_content(1024, 4));
+            write_file(grown_name, grown_content);
+            gi.reindex(g_db, k);
+
+            sqlite3pp::database g_fresh_db(g_fresh_db_name);
+            gi.reindex(g_fresh_db, k);
+
+            if( file_digest(g_db, "grown") != file_digest(g_fresh_db, "grown") )
+                throw std::xruntime_error("Stale digest of grown file", __FILE__, __LINE__);
+        }
+#if !_WIN32
+        // file renamed over other one of the same size and mtime is not
+        // taken for unchanged
+        std::string r_name = std::string("k") + path_delimiter + "r", q_name = std::string("k") + path_delimiter + "q";
+        write_file(q_name, random_content(8192, 5));
+        write_file(r_name, random_content(8192, 6));
+
+        for( const auto & name : { q_name, r_name } ) {
+            struct timeval times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+            utimes((tree + path_delimiter + name).c_str(), times);
+        }
+
+        std::string r_db_name = temp_name() + ".sqlite";
+        std::string r_fresh_db_name = temp_name() + ".sqlite";
+
+        at_scope_exit(
+            std::remove(r_db_name.c_str());
+            std::remove(r_fresh_db_name.c_str());
+        );
+
+        {
+            sqlite3pp::database r_db(r_db_name);
+            di.reindex(r_db, k);
+
+            std::rename((tree + path_delimiter + r_name).c_str(), (tree + path_delimiter + q_name).c_str());
+            di.reindex(r_db, k);
+
+            sqlite3pp::database r_fresh_db(r_fresh_db_name);
+            di.reindex(r_fresh_db, k);
+
+            if( file_digest(r_db, "q") != file_digest(r_fresh_db, "q") )
+                throw std::xruntime_error("Digest of replaced file kept", __FILE__, __LINE__);
+        }
+#endif
+        // block size grows by powers of two with file size within limits,
+        // limits are kept powers of two with minimum not above maximum
+        {
+            directory_indexer bi;
+
+            if( bi.block_size(0) != 4096
+                || bi.block_size(4096 * 1024) != 4096
+                || bi.block_size(4096 * 1024 + 1) != 8192
+                || bi.block_size(~uint64_t(0)) != 1024 * 1024 )
+                throw std::xruntime_error("Default block size policy broken", __FILE__, __LINE__);
+
+            bi.min_block_size(0);
+
+            if( bi.min_block_size() != 512 || bi.block_size(0) != 512 || bi.block_size(~uint64_t(0)) != 1024 * 1024 )
+                throw std::xruntime_error("Null minimum block size taken", __FILE__, __LINE__);
+
+            bi.min_block_size(3000).max_block_size(100);
+
+            if( bi.min_block_size() != 4096 || bi.max_block_size() != 4096 || bi.block_size(~uint64_t(0)) != 4096 )
+                throw std::xruntime_error("Block size limits crossed", __FILE__, __LINE__);
+
+            bi.max_block_size(3 * 1024 * 1024);
+
+            if( bi.max_block_size() != 2 * 1024 * 1024 || bi.block_size(~uint64_t(0)) != 2 * 1024 * 1024 )
+                throw std::xruntime_error("Maximum block size not power of two", __FILE__, __LINE__);
+
+            bi.min_block_size(~uint64_t(0));
+
+            if( bi.min_block_size() != directory_indexer::highest_block_size
+                || bi.max_block_size() != directory_indexer::highest_block_size )
+                throw std::xruntime_error("Block size limits overflown", __FILE__, __LINE__);
+        }
+
+        // blocks stored with fixed block size before it grew with file size
+        // are rehashed by size of now, smaller files keep theirs
+        std::string wide_name = std::string("k") + path_delimiter + "wide";
+        write_file(wide_name, random_content(5 * 1024 * 1024 + 100, 7));
+
+        std::string w_db_name = temp_name() + ".sqlite";
+        std::string w_fresh_db_name = temp_name() + ".sqlite";
+
+        at_scope_exit(
+            std::remove(w_db_name.c_str());
+            std::remove(w_fresh_db_name.c_str());
+        );
+
+        auto blocks_of = [] (sqlite3pp::database & db, const char * name) {
+            sqlite3pp::query st(db, R"EOS(
+                SELECT
+                    e.block_size, COUNT(*), MAX(b.block_length)
+                FROM
+                    entries AS e INNER JOIN blocks_digests AS b ON b.entry_id = e.id
+                WHERE
+                    e.name = :name
+            )EOS");
+            st.bind("name", name, sqlite3pp::nocopy);
+
+            auto i = st.begin();
+
+            return std::to_string(i->get<uint64_t>(0)) + " "
+                + std::to_string(i->get<uint64_t>(1)) + " "
+                + std::to_string(i->get<uint64_t>(2));
+        };
+
+        {
+            directory_indexer fi;
+            fi.min_block_size(4096).max_block_size(4096);
+
+            sqlite3pp::database w_db(w_db_name);
+            fi.reindex(w_db, k);
+
+            if( blocks_of(w_db, "wide") != "4096 1281 4096" )
+                throw std::xruntime_error("Fixed block size not applied", __FILE__, __LINE__);
+
+            di.reindex(w_db, k);
+
+            sqlite3pp::database w_fresh_db(w_fresh_db_name);
+            di.reindex(w_fresh_db, k);
+
+            if( blocks_of(w_db, "wide") != "8192 641 8192"
+                || file_digest(w_db, "wide") != file_digest(w_fresh_db, "wide")
+                || blocks_of(w_db, "cdc") != "4096 257 4096" )
+                throw std::xruntime_error("Blocks of fixed block size kept", __FILE__, __LINE__);
+        }
 	}
     catch (const std::exception & e) {
         std::cerr << e << std::endl;
@@ -0,0 +1,97 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+#include <iostream>
+#include <cstdio>
+#include <set>
+//------------------------------------------------------------------------------
+#include "port.hpp"
+#include "sequence.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+namespace tests {
+//------------------------------------------------------------------------------
+void sequence_test()
+{
+    bool fail = false;
+
+    try {
+        std::string db_name = temp_name() + ".sqlite";
+        at_scope_exit( std::remove(db_name.c_str()) );
+
+        std::set<uint64_t> ids;
+        uint64_t last = 0;
+
+        auto take = [&] (id_sequence & seq, size_t count) {
+            for( size_t i = 0; i < count; i++ ) {
+                auto id = seq.next();
+
+                if( id == 0 || id <= last || !ids.insert(id).second )
+                    throw std::xruntime_error("Sequence id is not unique", __FILE__, __LINE__);
+
+                last = id;
+            }
+        };
+
+        for( int pass = 0; pass < 2; pass++ ) {
+            sqlite3pp::database db;
+            db.connect(db_name, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+
+            // ranges must survive reopening database, ids already handed out
+            // from them are never reused
+            {
+                id_sequence seq(db, "test", 3);
+                take(seq, 10);
+            }
+
+            // reservation inside transaction of caller
+            {
+                sqlite3pp::transaction tx(&db);
+                id_sequence seq(db, "test", 3);
+                take(seq, 10);
+            }
+
+            id_sequence other(db, "other", 3);
+
+            if( ids.find(other.next()) != ids.end() )
+                throw std::xruntime_error("Sequences collide", __FILE__, __LINE__);
+        }
+    }
+    catch (const std::exception & e) {
+        std::cerr << e << std::endl;
+        fail = true;
+    }
+    catch (...) {
+        fail = true;
+    }
+
+    std::cerr << "sequence test " << (fail ? "failed" : "passed") << std::endl;
+}
+//------------------------------------------------------------------------------
+} // namespace tests
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
@@ -0,0 +1,99 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+#include <iostream>
+//------------------------------------------------------------------------------
+#include "port.hpp"
+#include "throttle.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+namespace tests {
+//------------------------------------------------------------------------------
+void throttle_test()
+{
+    bool fail = false;
+
+    try {
+        auto near = [] (uint64_t wait, double seconds) {
+            return wait > seconds * 0.8e9 && wait < seconds * 1.2e9;
+        };
+
+        io_throttle t;
+        t.bytes_per_second(10000000);
+
+        // one second of budget at start, rest is debt
+        if( t.reserve(10000000, 0) != 0 || !near(t.reserve(5000000, 0), 0.5) )
+            throw std::xruntime_error("Bytes budget mismatch", __FILE__, __LINE__);
+
+        // limit set at run time starts with empty bucket
+        t.bytes_per_second(0).ops_per_second(100);
+
+        if( t.reserve(1000000000, 0) != 0 || !near(t.reserve(0, 10), 0.1) )
+            throw std::xruntime_error("Operations budget mismatch", __FILE__, __LINE__);
+
+        if( t.acquire(0, 1000, [] { return true; }) )
+            throw std::xruntime_error("Cancelled wait succeeded", __FILE__, __LINE__);
+
+        // latency rising far above baseline halves the rate, unlimited reads
+        // are spaced then
+        io_throttle b;
+
+        for( int i = 0; i < 10; i++ )
+            b.sample(2e5);
+
+        b.sample(2e7);
+        b.sample(2e7);
+
+        if( b.scale() != 0.25 || !near(b.reserve(0, 1), 0.06) )
+            throw std::xruntime_error("Latency backoff expected", __FILE__, __LINE__);
+
+        b.sample(2e5);
+
+        if( b.scale() <= 0.25 )
+            throw std::xruntime_error("Latency backoff recovery expected", __FILE__, __LINE__);
+
+        // statistics of real device must not break anything
+        b.device(1);
+        b.reserve(0, 1);
+
+        // must not fail where not supported
+        leave_idle_io_priority(enter_idle_io_priority());
+    }
+    catch (const std::exception & e) {
+        std::cerr << e << std::endl;
+        fail = true;
+    }
+    catch (...) {
+        fail = true;
+    }
+
+    std::cerr << "throttle test " << (fail ? "failed" : "passed") << std::endl;
+}
+//------------------------------------------------------------------------------
+} // namespace tests
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------
@@ -0,0 +1,126 @@
+/*-
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Guram Duka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//------------------------------------------------------------------------------
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+//------------------------------------------------------------------------------
+#include "port.hpp"
+#include "watcher.hpp"
+//------------------------------------------------------------------------------
+namespace homeostas {
+//------------------------------------------------------------------------------
+namespace tests {
+//------------------------------------------------------------------------------
+void watcher_test()
+{
+    bool fail = false;
+
+    try {
+        std::string tree = temp_name();
+        std::string sub = tree + path_delimiter + "sub";
+        std::string file_name = sub + path_delimiter + "file";
+
+        mkdir(tree);
+
+        at_scope_exit(
+            std::remove(file_name.c_str());
+            std::remove(sub.c_str());
+            std::remove(tree.c_str());
+        );
+
+        for( auto fanotify : { true, false } ) {
+            std::mutex mtx;
+            std::map<std::string, bool> changed;
+
+            auto watcher = directory_watcher::make(tree, [&] (const std::string & path_name, bool recursive) {
+                std::unique_lock<std::mutex> lk(mtx);
+                auto & r = changed[path_name];
+                r = r || recursive;
+            }, fanotify);
+
+            // not supported on platform
+            if( watcher == nullptr )
+                break;
+
+            auto wait_for = [&] (const std::string & path_name, bool recursive) {
+                for( int i = 0; i < 100; i++ ) {
+                    std::unique_lock<std::mutex> lk(mtx);
+                    auto it = changed.find(path_name);
+
+                    if( it != changed.end() && it->second == recursive ) {
+                        changed.clear();
+                        return true;
+                    }
+
+                    lk.unlock();
+                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                }
+
+                return false;
+            };
+
+            // new directory is reported for whole listing, its parent too
+            mkdir(sub);
+
+            if( !wait_for(sub, true) )
+                throw std::xruntime_error(std::string(watcher->name()) + " missed new directory", __FILE__, __LINE__);
+
+            {
+                std::ofstream f(file_name, std::ios::binary);
+                f << "content";
+            }
+
+            if( !wait_for(sub, false) )
+                throw std::xruntime_error(std::string(watcher->name()) + " missed new file", __FILE__, __LINE__);
+
+            std::remove(file_name.c_str());
+
+            if( !wait_for(sub, false) )
+                throw std::xruntime_error(std::string(watcher->name()) + " missed deleted file", __FILE__, __LINE__);
+
+            std::remove(sub.c_str());
+
+            if( !wait_for(tree, false) )
+                throw std::xruntime_error(std::string(watcher->name()) + " missed deleted directory", __FILE__, __LINE__);
+        }
+    }
+    catch (const std::exception & e) {
+        std::cerr << e << std::endl;
+        fail = true;
+    }
+    catch (...) {
+        fail = true;
+    }
+
+    std::cerr << "watcher test " << (fail ? "failed" : "passed") << std::endl;
+}
+//------------------------------------------------------------------------------
+} // namespace tests
+//------------------------------------------------------------------------------
+} // namespace homeostas
+//------------------------------------------------------------------------------